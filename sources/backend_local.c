@@ -0,0 +1,334 @@
+/*
+ * FreeSWITCH Modular Media Switching Software Library / Soft-Switch Application
+ * Copyright (C) 2005-2014, Anthony Minessale II <anthm@freeswitch.org>
+ *
+ * Version: MPL 1.1
+ *
+ * The contents of this file are subject to the Mozilla Public License Version
+ * 1.1 (the "License"); you may not use this file except in compliance with
+ * the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS" basis,
+ * WITHOUT WARRANTY OF ANY KIND, either express or implied. See the License
+ * for the specific language governing rights and limitations under the
+ * License.
+ *
+ * Module Contributor(s):
+ *  Konstantin Alexandrin <akscfx@gmail.com>
+ *
+ *
+ * backend_local.c -- binary framing for a transcription daemon on the same host
+ *
+ * No http, no multipart, no temporary files: every leg keeps a unix domain socket ('local-socket')
+ * open and an utterance goes out as one writev() of a fixed header and the samples as they are.
+ * The socket is non-blocking, both directions wait in short polls and give up on the session end or 'request-timeout'.
+ *
+ *  request:  "OASR" | version:u8 | codec:u8 | channels:u16 | samplerate:u32 | data_len:u32 | lang:char[8] | data
+ *  response: len:u32 | json, the same as /v1/audio/transcriptions returns
+ *
+ * Integers are in network byte order, codec is 1 - L16 (little-endian, swapped on big-endian hosts), 2 - PCMU, 3 - PCMA,
+ * lang is empty to detect.
+ *
+ */
+#include "mod_openai_asr.h"
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+#include <arpa/inet.h>
+#include <poll.h>
+#include <fcntl.h>
+#include <errno.h>
+
+#define LOCAL_MAGIC             "OASR"
+#define LOCAL_VERSION           1
+#define LOCAL_RESPONSE_MAX      (1024 * 1024)
+#define LOCAL_POLL_MS           100
+#define LOCAL_RECV_CHUNK        4096
+
+typedef struct {
+    char                    magic[4];
+    uint8_t                 version;
+    uint8_t                 codec;
+    uint16_t                channels;
+    uint32_t                samplerate;
+    uint32_t                data_len;
+    char                    lang[8];
+} local_frame_hdr_t;
+
+typedef struct {
+    int                     fd;
+} local_conn_t;
+
+static switch_bool_t local_aborted(asr_ctx_t *asr_ctx, asr_leg_t *leg, globals_t *globals) {
+    return (globals->fl_shutdown || asr_ctx->fl_destroyed || speculation_stale(asr_ctx, leg));
+}
+
+static void local_disconnect(local_conn_t *conn) {
+    if(conn->fd >= 0) {
+        close(conn->fd);
+        conn->fd = -1;
+    }
+}
+
+static switch_status_t local_connect(local_conn_t *conn, globals_t *globals) {
+    struct sockaddr_un addr = { 0 };
+    int flags = 0;
+
+    if(strlen(globals->local_socket) >= sizeof(addr.sun_path)) {
+        switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "Socket path is too long (%s)\n", globals->local_socket);
+        return SWITCH_STATUS_FALSE;
+    }
+    if((conn->fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0) {
+        switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "socket() failed (%s)\n", strerror(errno));
+        return SWITCH_STATUS_FALSE;
+    }
+
+    addr.sun_family = AF_UNIX;
+    switch_copy_string(addr.sun_path, globals->local_socket, sizeof(addr.sun_path));
+
+    if(connect(conn->fd, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+        switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "Unable to connect to %s (%s)\n", globals->local_socket, strerror(errno));
+        local_disconnect(conn);
+        return SWITCH_STATUS_FALSE;
+    }
+
+    /* a stuck daemon must not hold the worker, the transfers wait in poll() */
+    if((flags = fcntl(conn->fd, F_GETFL, 0)) < 0 || fcntl(conn->fd, F_SETFL, flags | O_NONBLOCK) < 0) {
+        switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "fcntl() failed (%s)\n", strerror(errno));
+        local_disconnect(conn);
+        return SWITCH_STATUS_FALSE;
+    }
+
+    return SWITCH_STATUS_SUCCESS;
+}
+
+/* SWITCH_STATUS_BREAK - the peer has closed the connection (or it's broken) */
+static switch_status_t local_send(local_conn_t *conn, asr_ctx_t *asr_ctx, asr_leg_t *leg, local_frame_hdr_t *hdr, switch_byte_t *data, uint32_t data_len, switch_time_t deadline, globals_t *globals) {
+    struct pollfd pfd = { 0 };
+    struct iovec iov[2];
+    struct iovec *piov = iov;
+    int iovcnt = 2;
+    ssize_t wlen = 0;
+
+    iov[0].iov_base = hdr;
+    iov[0].iov_len = sizeof(*hdr);
+    iov[1].iov_base = data;
+    iov[1].iov_len = data_len;
+
+    pfd.fd = conn->fd;
+    pfd.events = POLLOUT;
+
+    /* SIGPIPE is ignored by the core, a closed peer comes back as EPIPE */
+    while(iovcnt > 0) {
+        if(local_aborted(asr_ctx, leg, globals)) {
+            return SWITCH_STATUS_FALSE;
+        }
+        if(switch_micro_time_now() >= deadline) {
+            switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "Local daemon doesn't take the request\n");
+            return SWITCH_STATUS_FALSE;
+        }
+        if((wlen = writev(conn->fd, piov, iovcnt)) < 0) {
+            if(errno == EAGAIN || errno == EWOULDBLOCK) {
+                poll(&pfd, 1, LOCAL_POLL_MS);
+                continue;
+            }
+            if(errno == EINTR) {
+                continue;
+            }
+            return SWITCH_STATUS_BREAK;
+        }
+        while(iovcnt > 0 && (size_t)wlen >= piov->iov_len) {
+            wlen -= piov->iov_len;
+            piov++;
+            iovcnt--;
+        }
+        if(iovcnt > 0) {
+            piov->iov_base = (char *)piov->iov_base + wlen;
+            piov->iov_len -= wlen;
+        }
+    }
+
+    return SWITCH_STATUS_SUCCESS;
+}
+
+/* SWITCH_STATUS_BREAK - the peer has closed the connection before answering */
+static switch_status_t local_recv(local_conn_t *conn, asr_ctx_t *asr_ctx, asr_leg_t *leg, void *buf, uint32_t len, switch_time_t deadline, globals_t *globals) {
+    struct pollfd pfd = { 0 };
+    uint32_t ofs = 0;
+    ssize_t rlen = 0;
+
+    pfd.fd = conn->fd;
+    pfd.events = POLLIN;
+
+    while(ofs < len) {
+        if(local_aborted(asr_ctx, leg, globals)) {
+            return SWITCH_STATUS_FALSE;
+        }
+        if(switch_micro_time_now() >= deadline) {
+            switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "Local daemon response timed out\n");
+            return SWITCH_STATUS_FALSE;
+        }
+        if(poll(&pfd, 1, LOCAL_POLL_MS) <= 0) {
+            continue;
+        }
+        if((rlen = read(conn->fd, (char *)buf + ofs, len - ofs)) < 0) {
+            if(errno == EINTR || errno == EAGAIN) {
+                continue;
+            }
+            return SWITCH_STATUS_FALSE;
+        }
+        if(rlen == 0) {
+            return SWITCH_STATUS_BREAK;
+        }
+        ofs += rlen;
+    }
+
+    return SWITCH_STATUS_SUCCESS;
+}
+
+/* the body goes through the extractor as it's read, it's never kept whole */
+static switch_status_t local_request(local_conn_t *conn, asr_ctx_t *asr_ctx, asr_leg_t *leg, local_frame_hdr_t *hdr, switch_byte_t *data, uint32_t data_len, response_t *response, globals_t *globals) {
+    switch_time_t deadline = switch_micro_time_now() + ((switch_time_t)(globals->request_timeout > 0 ? globals->request_timeout : 60) * 1000000);
+    switch_status_t status = SWITCH_STATUS_FALSE;
+    uint32_t resp_len = 0, len = 0;
+    char buf[LOCAL_RECV_CHUNK];
+
+    if((status = local_send(conn, asr_ctx, leg, hdr, data, data_len, deadline, globals)) != SWITCH_STATUS_SUCCESS) {
+        return status;
+    }
+    if((status = local_recv(conn, asr_ctx, leg, &resp_len, sizeof(resp_len), deadline, globals)) != SWITCH_STATUS_SUCCESS) {
+        return status;
+    }
+    if((resp_len = ntohl(resp_len)) > LOCAL_RESPONSE_MAX) {
+        switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "Malformed response (length=%u)\n", resp_len);
+        return SWITCH_STATUS_FALSE;
+    }
+
+    response_reset(response);
+    while(resp_len > 0) {
+        len = MIN(resp_len, sizeof(buf));
+        if((status = local_recv(conn, asr_ctx, leg, buf, len, deadline, globals)) != SWITCH_STATUS_SUCCESS) {
+            return (status == SWITCH_STATUS_BREAK ? SWITCH_STATUS_FALSE : status);
+        }
+        response_feed(response, buf, len);
+        resp_len -= len;
+    }
+
+    return SWITCH_STATUS_SUCCESS;
+}
+
+// ---------------------------------------------------------------------------------------------------------------------------------------------
+static switch_status_t local_backend_load(globals_t *globals, switch_memory_pool_t *pool) {
+    if(zstr(globals->local_socket)) {
+        if(globals->backend == &backend_local) {
+            switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "Missing required parameter: local-socket\n");
+        }
+        return SWITCH_STATUS_FALSE;
+    }
+    return SWITCH_STATUS_SUCCESS;
+}
+
+static switch_status_t local_backend_transcribe(asr_ctx_t *asr_ctx, asr_leg_t *leg, switch_byte_t *data, uint32_t data_len, globals_t *globals) {
+    switch_status_t status = SWITCH_STATUS_FALSE;
+    local_conn_t *conn = (local_conn_t *)leg->stream;
+    local_frame_hdr_t hdr = { 0 };
+    const char *lang = lang_request_language(asr_ctx, leg, globals);
+    response_t *response = &LEG_RESPONSES(asr_ctx, leg)[0];
+    switch_byte_t *swapped = NULL;
+    uint32_t attempt = 0;
+
+    if(zstr(globals->local_socket)) {
+        switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "local backend isn't configured (local-socket)\n");
+        return SWITCH_STATUS_FALSE;
+    }
+    if(!conn) {
+        switch_zmalloc(conn, sizeof(local_conn_t));
+        conn->fd = -1;
+        leg->stream = conn;
+    }
+
+    memcpy(hdr.magic, LOCAL_MAGIC, sizeof(hdr.magic));
+    hdr.version = LOCAL_VERSION;
+    hdr.codec = (uint8_t)asr_ctx->codec;
+    hdr.channels = htons((uint16_t)asr_ctx->channels);
+    hdr.samplerate = htonl(asr_ctx->samplerate);
+    hdr.data_len = htonl(data_len);
+    if(lang) {
+        strncpy(hdr.lang, lang, sizeof(hdr.lang));
+    }
+
+#if SWITCH_BYTE_ORDER == __BIG_ENDIAN
+    if(asr_ctx->codec == ASR_CODEC_L16) {
+        switch_malloc(swapped, data_len);
+        memcpy(swapped, data, data_len);
+        switch_swap_linear((int16_t *)swapped, (int)(data_len / sizeof(int16_t)));
+        data = swapped;
+    }
+#endif
+
+    /* a kept connection may have been closed by the daemon meanwhile, one more try on a new one */
+    for(attempt = 0; attempt < 2; attempt++) {
+        if(conn->fd < 0 && local_connect(conn, globals) != SWITCH_STATUS_SUCCESS) {
+            goto out;
+        }
+        if((status = local_request(conn, asr_ctx, leg, &hdr, data, data_len, response, globals)) == SWITCH_STATUS_SUCCESS) {
+            break;
+        }
+        local_disconnect(conn);
+        if(status != SWITCH_STATUS_BREAK) {
+            goto out;
+        }
+    }
+    if(status != SWITCH_STATUS_SUCCESS) {
+        switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "Unable to perform request to %s\n", globals->local_socket);
+        goto out;
+    }
+
+    status = SWITCH_STATUS_FALSE;
+    if(!response_complete(response)) {
+        switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "Unable to parse json (%s)\n", response->head);
+        goto out;
+    }
+    if(response->fl_error) {
+        switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "Service response: %s\n", (response->error[0] ? response->error : response->head));
+        goto out;
+    }
+    if(!response->fl_text) {
+        switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "Malformed response: (%s)\n", response->head);
+        goto out;
+    }
+
+    asr_result_push_response(asr_ctx, leg, response);
+    lang_detect_update(asr_ctx, leg, response, globals);
+    status = SWITCH_STATUS_SUCCESS;
+
+out:
+    switch_safe_free(swapped);
+    return status;
+}
+
+static void local_backend_close(asr_ctx_t *asr_ctx) {
+    uint32_t i = 0;
+
+    for(i = 0; i < asr_ctx->legs_count; i++) {
+        local_conn_t *conn = (local_conn_t *)asr_ctx->legs[i].stream;
+
+        if(conn) {
+            local_disconnect(conn);
+            switch_safe_free(conn);
+            asr_ctx->legs[i].stream = NULL;
+        }
+    }
+}
+
+asr_backend_t backend_local = {
+    "local",
+    local_backend_load,
+    NULL,
+    local_backend_transcribe,
+    NULL,
+    NULL,
+    NULL,
+    local_backend_close
+};
@@ -0,0 +1,57 @@
+/*
+ * FreeSWITCH Modular Media Switching Software Library / Soft-Switch Application
+ * Copyright (C) 2005-2014, Anthony Minessale II <anthm@freeswitch.org>
+ *
+ * Version: MPL 1.1
+ *
+ * The contents of this file are subject to the Mozilla Public License Version
+ * 1.1 (the "License"); you may not use this file except in compliance with
+ * the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS" basis,
+ * WITHOUT WARRANTY OF ANY KIND, either express or implied. See the License
+ * for the specific language governing rights and limitations under the
+ * License.
+ *
+ * Module Contributor(s):
+ *  Konstantin Alexandrin <akscfx@gmail.com>
+ *
+ *
+ * backend_mock.c -- a stand-in transcriber for openai_asr_replay
+ *
+ * Answers every utterance after 'mock-latency-ms' with its length, so the replays measure
+ * the module (VAD, endpointing, speculation) and not the service.
+ *
+ */
+#include "mod_openai_asr.h"
+
+#define MOCK_POLL_MS            10
+
+static switch_status_t mock_backend_transcribe(asr_ctx_t *asr_ctx, asr_leg_t *leg, switch_byte_t *data, uint32_t data_len, globals_t *globals) {
+    switch_time_t until = switch_micro_time_now() + ((switch_time_t)globals->mock_latency_ms * 1000);
+    char text[64] = { 0 };
+
+    while(switch_micro_time_now() < until) {
+        if(globals->fl_shutdown || asr_ctx->fl_destroyed || speculation_stale(asr_ctx, leg)) {
+            return SWITCH_STATUS_FALSE;
+        }
+        switch_yield(MOCK_POLL_MS * 1000);
+    }
+
+    switch_snprintf(text, sizeof(text), "utterance of %u ms", (uint32_t)(((uint64_t)data_len * 1000) / (asr_ctx->samplerate * ASR_SAMPLE_BYTES(asr_ctx))));
+    asr_result_push(asr_ctx, leg, text);
+
+    return SWITCH_STATUS_SUCCESS;
+}
+
+asr_backend_t backend_mock = {
+    "mock",
+    NULL,
+    NULL,
+    mock_backend_transcribe,
+    NULL,
+    NULL,
+    NULL,
+    NULL
+};
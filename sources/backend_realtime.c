@@ -0,0 +1,729 @@
+/*
+ * FreeSWITCH Modular Media Switching Software Library / Soft-Switch Application
+ * Copyright (C) 2005-2014, Anthony Minessale II <anthm@freeswitch.org>
+ *
+ * Version: MPL 1.1
+ *
+ * The contents of this file are subject to the Mozilla Public License Version
+ * 1.1 (the "License"); you may not use this file except in compliance with
+ * the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS" basis,
+ * WITHOUT WARRANTY OF ANY KIND, either express or implied. See the License
+ * for the specific language governing rights and limitations under the
+ * License.
+ *
+ * Module Contributor(s):
+ *  Konstantin Alexandrin <akscfx@gmail.com>
+ *
+ *
+ * backend_realtime.c -- realtime transcription over a WebSocket (libcurl >= 7.86)
+ *
+ * Every leg keeps its own connection, the frames are appended to the server buffer as they come
+ * and committed when the VAD closes the utterance; deltas go out as partial result events, the
+ * completed transcripts as the usual results.
+ * The audio stays buffered until its transcript arrives and is replayed after a reconnect.
+ *
+ */
+#include "mod_openai_asr.h"
+
+#define REALTIME_SAMPLERATE         24000
+#define REALTIME_SEGMENTS_MAX       8
+#define REALTIME_APPEND_MAX         8192    // bytes of audio per append message
+#define REALTIME_SEND_QUEUE_MAX     (1024 * 1024)
+#define REALTIME_RECONNECT_MAX_MS   5000
+
+typedef struct {
+    uint32_t                len;
+    uint8_t                 fl_done;
+    char                    item_id[64];        // assigned by input_audio_buffer.committed
+} rt_segment_t;
+
+typedef struct {
+    asr_ctx_t               *asr_ctx;
+    asr_leg_t               *leg;
+    globals_t               *globals;
+    CURLM                   *multi;             // the worker's one, or an own one for openai_asr_bench
+    CURL                    *handle;
+    switch_curl_slist_t     *headers;
+    api_key_t               *api_key;           // taken for the current connection
+    ratelimit_info_t        ratelimit;          // from the handshake response
+    switch_audio_resampler_t *resampler;
+    switch_buffer_t         *pending;           // committed segments awaiting the transcript + the open one
+    switch_buffer_t         *recv_buffer;       // reassembles fragmented messages
+    switch_buffer_t         *send_buffer;       // messages the socket didn't take yet ([uint32_t len][text] each)
+    rt_segment_t            segments[REALTIME_SEGMENTS_MAX];
+    uint32_t                segments_count;
+    uint32_t                open_len;           // appended but not yet committed
+    uint32_t                reconnects;         // in a row
+    switch_time_t           reconnect_at;
+    char                    *partial;           // deltas of the current item
+    char                    partial_id[64];
+    uint8_t                 fl_own_multi;
+    uint8_t                 fl_connecting;      // the handshake is driven by the multi handle
+    uint8_t                 fl_connected;
+} rt_stream_t;
+
+static int rt_xferinfo_callback(void *user_data, curl_off_t dltotal, curl_off_t dlnow, curl_off_t ultotal, curl_off_t ulnow) {
+    rt_stream_t *stream = (rt_stream_t *)user_data;
+
+    return (stream->globals->fl_shutdown || stream->asr_ctx->fl_destroyed || stream->asr_ctx->fl_abort) ? 1 : 0;
+}
+
+static size_t rt_header_callback(char *buffer, size_t size, size_t nitems, void *user_data) {
+    rt_stream_t *stream = (rt_stream_t *)user_data;
+    size_t len = (size * nitems);
+
+    if(len > 0 && stream) {
+        ratelimit_header_parse(&stream->ratelimit, buffer, len);
+    }
+
+    return len;
+}
+
+static const char *rt_audio_format(asr_ctx_t *asr_ctx) {
+    switch(asr_ctx->codec) {
+        case ASR_CODEC_PCMU: return "g711_ulaw";
+        case ASR_CODEC_PCMA: return "g711_alaw";
+        default: return "pcm16";
+    }
+}
+
+static void rt_disconnect(rt_stream_t *stream) {
+    if(stream->handle) {
+        /* a connect-only handle stays in the multi till now, its connection lives in the multi's cache */
+        curl_multi_remove_handle(stream->multi, stream->handle);
+        switch_curl_easy_cleanup(stream->handle);
+        stream->handle = NULL;
+    }
+    if(stream->headers) {
+        switch_curl_slist_free_all(stream->headers);
+        stream->headers = NULL;
+    }
+    if(stream->recv_buffer) {
+        switch_buffer_zero(stream->recv_buffer);
+    }
+    /* the audio is replayed from 'pending' on the next connection */
+    if(stream->send_buffer) {
+        switch_buffer_zero(stream->send_buffer);
+    }
+    switch_safe_free(stream->partial);
+    stream->partial_id[0] = '\0';
+    stream->api_key = NULL;
+    stream->fl_connecting = SWITCH_FALSE;
+    stream->fl_connected = SWITCH_FALSE;
+}
+
+static void rt_reconnect_schedule(rt_stream_t *stream) {
+    uint32_t delay_ms = MIN((MAX(stream->globals->retry_delay_ms, 1) << MIN(stream->reconnects, 5)), REALTIME_RECONNECT_MAX_MS);
+
+    rt_disconnect(stream);
+    stream->reconnects++;
+    stream->reconnect_at = switch_micro_time_now() + (delay_ms * 1000);
+
+    switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_WARNING, "Realtime connection lost, reconnecting in %u ms (attempt %u)\n", delay_ms, stream->reconnects);
+}
+
+/* sends the queued messages in order, stops (without an error) as soon as the socket is full */
+static switch_status_t rt_send_flush(rt_stream_t *stream) {
+    const void *ptr = NULL;
+    CURLcode ret = CURLE_OK;
+    uint32_t len = 0;
+    size_t sent = 0;
+
+    while(switch_buffer_inuse(stream->send_buffer) > sizeof(len)) {
+        switch_buffer_peek(stream->send_buffer, &len, sizeof(len));
+        switch_buffer_peek_zerocopy(stream->send_buffer, &ptr);
+
+        ret = curl_ws_send(stream->handle, (const char *)ptr + sizeof(len), len, &sent, 0, CURLWS_TEXT);
+        if(ret == CURLE_AGAIN && sent == 0) {
+            break;
+        }
+        /* a frame cut in the middle can't be resumed, the audio is replayed on the new connection */
+        if(ret != CURLE_OK || sent != len) {
+            switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "curl_ws_send() failed (%s)\n", curl_easy_strerror(ret));
+            return SWITCH_STATUS_FALSE;
+        }
+        switch_buffer_toss(stream->send_buffer, sizeof(len) + len);
+    }
+
+    return SWITCH_STATUS_SUCCESS;
+}
+
+/*
+ * never waits for the socket: what it doesn't take right away is queued whole
+ * and goes out from the worker loop (rt_stream_poll) before anything newer
+ */
+static switch_status_t rt_send(rt_stream_t *stream, const char *text, size_t text_len) {
+    CURLcode ret = CURLE_OK;
+    uint32_t len = (uint32_t)text_len;
+    size_t sent = 0;
+
+    if(switch_buffer_inuse(stream->send_buffer) == 0) {
+        ret = curl_ws_send(stream->handle, text, text_len, &sent, 0, CURLWS_TEXT);
+        if(ret == CURLE_OK && sent == text_len) {
+            return SWITCH_STATUS_SUCCESS;
+        }
+        if(ret != CURLE_AGAIN || sent != 0) {
+            switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "curl_ws_send() failed (%s)\n", curl_easy_strerror(ret));
+            return SWITCH_STATUS_FALSE;
+        }
+    }
+
+    if(switch_buffer_inuse(stream->send_buffer) + sizeof(len) + text_len > REALTIME_SEND_QUEUE_MAX) {
+        switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "Realtime send queue is full\n");
+        return SWITCH_STATUS_FALSE;
+    }
+    switch_buffer_write(stream->send_buffer, &len, sizeof(len));
+    switch_buffer_write(stream->send_buffer, text, text_len);
+
+    return SWITCH_STATUS_SUCCESS;
+}
+
+static switch_status_t rt_send_json(rt_stream_t *stream, cJSON *json) {
+    switch_status_t status = SWITCH_STATUS_FALSE;
+    char *text = NULL;
+
+    if((text = cJSON_PrintUnformatted(json)) != NULL) {
+        status = rt_send(stream, text, strlen(text));
+        switch_safe_free(text);
+    }
+
+    return status;
+}
+
+static switch_status_t rt_send_append(rt_stream_t *stream, const switch_byte_t *data, uint32_t data_len) {
+    switch_status_t status = SWITCH_STATUS_SUCCESS;
+    switch_size_t b64_len = 0, msg_len = 0;
+    char *msg = NULL;
+    uint32_t ofs = 0, len = 0;
+
+    for(ofs = 0; ofs < data_len && status == SWITCH_STATUS_SUCCESS; ofs += len) {
+        len = MIN(data_len - ofs, REALTIME_APPEND_MAX);
+        b64_len = (((len + 2) / 3) * 4) + 1;
+
+        switch_safe_free(msg);
+        switch_malloc(msg, b64_len + 64);
+
+        msg_len = switch_snprintf(msg, 64, "{\"type\":\"input_audio_buffer.append\",\"audio\":\"");
+        switch_b64_encode((unsigned char *)data + ofs, len, (unsigned char *)msg + msg_len, b64_len);
+        msg_len += strlen(msg + msg_len);
+        memcpy(msg + msg_len, "\"}", 3);
+        msg_len += 2;
+
+        status = rt_send(stream, msg, msg_len);
+    }
+
+    switch_safe_free(msg);
+    return status;
+}
+
+static switch_status_t rt_send_type(rt_stream_t *stream, const char *type) {
+    char msg[128];
+
+    switch_snprintf(msg, sizeof(msg), "{\"type\":\"%s\"}", type);
+    return rt_send(stream, msg, strlen(msg));
+}
+
+static switch_status_t rt_send_session(rt_stream_t *stream, asr_leg_t *leg) {
+    asr_ctx_t *asr_ctx = stream->asr_ctx;
+    const char *lang = lang_request_language(asr_ctx, leg, stream->globals);
+    cJSON *json = NULL, *session = NULL, *transcription = NULL;
+    switch_status_t status = SWITCH_STATUS_FALSE;
+
+    json = cJSON_CreateObject();
+    session = cJSON_CreateObject();
+    transcription = cJSON_CreateObject();
+
+    cJSON_AddItemToObject(transcription, "model", cJSON_CreateString(asr_ctx->opt_model ? asr_ctx->opt_model : stream->globals->opt_model));
+    if(lang) {
+        cJSON_AddItemToObject(transcription, "language", cJSON_CreateString(lang));
+    }
+    cJSON_AddItemToObject(session, "input_audio_format", cJSON_CreateString(rt_audio_format(asr_ctx)));
+    cJSON_AddItemToObject(session, "input_audio_transcription", transcription);
+    /* the utterances are cut by our VAD */
+    cJSON_AddItemToObject(session, "turn_detection", cJSON_CreateNull());
+    cJSON_AddItemToObject(json, "type", cJSON_CreateString("transcription_session.update"));
+    cJSON_AddItemToObject(json, "session", session);
+
+    status = rt_send_json(stream, json);
+
+    cJSON_Delete(json);
+    return status;
+}
+
+/* starts the handshake, it goes on in the multi handle and ends in rt_connect_done() */
+static switch_status_t rt_connect(rt_stream_t *stream) {
+    globals_t *globals = stream->globals;
+    CURLMcode mret = CURLM_OK;
+    switch_time_t wait = 0;
+
+    /* every connection takes its own key, so the sessions spread over them the way the http requests do */
+    if((stream->api_key = apikey_acquire(globals, 0, &wait)) == NULL) {
+        stream->reconnect_at = switch_micro_time_now() + MAX(wait, 100000);
+        switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_DEBUG, "All api keys are paused, connecting in %d ms\n", (int)(wait / 1000));
+        return SWITCH_STATUS_FALSE;
+    }
+    ratelimit_info_init(&stream->ratelimit);
+
+    if((stream->handle = switch_curl_easy_init()) == NULL) {
+        switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "switch_curl_easy_init()\n");
+        goto fail;
+    }
+
+    stream->headers = switch_curl_slist_append(stream->headers, "OpenAI-Beta: realtime=v1");
+
+    switch_curl_easy_setopt(stream->handle, CURLOPT_URL, globals->realtime_url);
+    switch_curl_easy_setopt(stream->handle, CURLOPT_CONNECT_ONLY, 2L);
+    switch_curl_easy_setopt(stream->handle, CURLOPT_PRIVATE, stream);
+    switch_curl_easy_setopt(stream->handle, CURLOPT_HTTPHEADER, stream->headers);
+    switch_curl_easy_setopt(stream->handle, CURLOPT_NOSIGNAL, 1);
+    switch_curl_easy_setopt(stream->handle, CURLOPT_NOPROGRESS, 0);
+    switch_curl_easy_setopt(stream->handle, CURLOPT_XFERINFOFUNCTION, rt_xferinfo_callback);
+    switch_curl_easy_setopt(stream->handle, CURLOPT_XFERINFODATA, (void *) stream);
+    switch_curl_easy_setopt(stream->handle, CURLOPT_HEADERFUNCTION, rt_header_callback);
+    switch_curl_easy_setopt(stream->handle, CURLOPT_HEADERDATA, (void *) stream);
+
+    if(globals->connect_timeout > 0) {
+        switch_curl_easy_setopt(stream->handle, CURLOPT_CONNECTTIMEOUT, globals->connect_timeout);
+    }
+    if(globals->user_agent) {
+        switch_curl_easy_setopt(stream->handle, CURLOPT_USERAGENT, globals->user_agent);
+    }
+    if(strncasecmp(globals->realtime_url, "wss", 3) == 0 && !globals->fl_tls_verify) {
+        switch_curl_easy_setopt(stream->handle, CURLOPT_SSL_VERIFYPEER, 0);
+        switch_curl_easy_setopt(stream->handle, CURLOPT_SSL_VERIFYHOST, 0);
+    }
+    if(globals->proxy) {
+        if(globals->proxy_credentials != NULL) {
+            switch_curl_easy_setopt(stream->handle, CURLOPT_PROXYAUTH, CURLAUTH_ANY);
+            switch_curl_easy_setopt(stream->handle, CURLOPT_PROXYUSERPWD, globals->proxy_credentials);
+        }
+        switch_curl_easy_setopt(stream->handle, CURLOPT_PROXY, globals->proxy);
+    }
+
+    curl_easy_setopt(stream->handle, CURLOPT_XOAUTH2_BEARER, stream->api_key->key);
+    curl_easy_setopt(stream->handle, CURLOPT_HTTPAUTH, CURLAUTH_BEARER);
+
+    if((mret = curl_multi_add_handle(stream->multi, stream->handle)) != CURLM_OK) {
+        switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "curl_multi_add_handle() failed (%s)\n", curl_multi_strerror(mret));
+        goto fail;
+    }
+    stream->fl_connecting = SWITCH_TRUE;
+
+    return SWITCH_STATUS_SUCCESS;
+
+fail:
+    rt_reconnect_schedule(stream);
+    return SWITCH_STATUS_FALSE;
+}
+
+static void rt_connect_done(rt_stream_t *stream, CURLcode result) {
+    globals_t *globals = stream->globals;
+    const void *ptr = NULL;
+    uint32_t i = 0, ofs = 0;
+    long http_resp = 0;
+
+    stream->fl_connecting = SWITCH_FALSE;
+
+    /* a refused upgrade (429 and the like) still has its status and x-ratelimit-* headers */
+    switch_curl_easy_getinfo(stream->handle, CURLINFO_RESPONSE_CODE, &http_resp);
+    apikey_update(globals, stream->api_key, &stream->ratelimit, http_resp);
+
+    if(result != CURLE_OK) {
+        switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "Unable to connect to %s (%s, http %ld)\n", globals->realtime_url, curl_easy_strerror(result), http_resp);
+        goto fail;
+    }
+    stream->fl_connected = SWITCH_TRUE;
+
+    if(rt_send_session(stream, stream->leg) != SWITCH_STATUS_SUCCESS) {
+        goto fail;
+    }
+
+    /* replay whatever hasn't been transcribed yet, the server item ids start over */
+    switch_buffer_peek_zerocopy(stream->pending, &ptr);
+    for(i = 0; i < stream->segments_count; i++) {
+        rt_segment_t *seg = &stream->segments[i];
+
+        seg->item_id[0] = '\0';
+        if(!seg->fl_done) {
+            if(rt_send_append(stream, (switch_byte_t *)ptr + ofs, seg->len) != SWITCH_STATUS_SUCCESS || rt_send_type(stream, "input_audio_buffer.commit") != SWITCH_STATUS_SUCCESS) {
+                goto fail;
+            }
+        }
+        ofs += seg->len;
+    }
+    if(stream->open_len && rt_send_append(stream, (switch_byte_t *)ptr + ofs, stream->open_len) != SWITCH_STATUS_SUCCESS) {
+        goto fail;
+    }
+
+    return;
+
+fail:
+    rt_reconnect_schedule(stream);
+}
+
+/* the streams of a session share the multi handle, whoever reads a message hands it to its own stream */
+static void rt_multi_perform(CURLM *multi) {
+    CURLMsg *msg = NULL;
+    int running = 0, msgs_left = 0;
+
+    curl_multi_perform(multi, &running);
+
+    while((msg = curl_multi_info_read(multi, &msgs_left))) {
+        rt_stream_t *stream = NULL;
+
+        if(msg->msg != CURLMSG_DONE) {
+            continue;
+        }
+        switch_curl_easy_getinfo(msg->easy_handle, CURLINFO_PRIVATE, (char **)&stream);
+        if(stream && stream->fl_connecting && stream->handle == msg->easy_handle) {
+            rt_connect_done(stream, msg->data.result);
+        }
+    }
+}
+
+/* drops the transcribed segments from the head of the pending buffer */
+static void rt_segments_release(rt_stream_t *stream) {
+    uint32_t n = 0, len = 0;
+
+    while(n < stream->segments_count && stream->segments[n].fl_done) {
+        len += stream->segments[n].len;
+        n++;
+    }
+    if(n > 0) {
+        switch_buffer_toss(stream->pending, len);
+        memmove(stream->segments, stream->segments + n, (stream->segments_count - n) * sizeof(rt_segment_t));
+        stream->segments_count -= n;
+    }
+}
+
+static rt_segment_t *rt_segment_lookup(rt_stream_t *stream, const char *item_id) {
+    uint32_t i = 0;
+
+    for(i = 0; i < stream->segments_count; i++) {
+        if(!strcmp(stream->segments[i].item_id, item_id)) {
+            return &stream->segments[i];
+        }
+    }
+    return NULL;
+}
+
+static void rt_message_process(rt_stream_t *stream, asr_leg_t *leg, const char *msg) {
+    cJSON *json = NULL, *jtype = NULL, *jitem = NULL, *jtext = NULL;
+    const char *item_id = NULL;
+    rt_segment_t *seg = NULL;
+    uint32_t i = 0;
+
+    if((json = cJSON_Parse(msg)) == NULL) {
+        switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "Unable to parse json (%s)\n", msg);
+        return;
+    }
+    if((jtype = cJSON_GetObjectItem(json, "type")) == NULL || jtype->type != cJSON_String) {
+        goto out;
+    }
+    if((jitem = cJSON_GetObjectItem(json, "item_id")) && jitem->type == cJSON_String) {
+        item_id = jitem->valuestring;
+    }
+
+    if(!strcmp(jtype->valuestring, "input_audio_buffer.committed")) {
+        /* in the order of the commits */
+        for(i = 0; i < stream->segments_count && item_id; i++) {
+            if(!stream->segments[i].fl_done && stream->segments[i].item_id[0] == '\0') {
+                switch_copy_string(stream->segments[i].item_id, item_id, sizeof(stream->segments[i].item_id));
+                break;
+            }
+        }
+    } else if(!strcmp(jtype->valuestring, "conversation.item.input_audio_transcription.delta")) {
+        if((jtext = cJSON_GetObjectItem(json, "delta")) && jtext->type == cJSON_String && item_id) {
+            char *partial = NULL;
+
+            if(strcmp(stream->partial_id, item_id)) {
+                switch_safe_free(stream->partial);
+                switch_copy_string(stream->partial_id, item_id, sizeof(stream->partial_id));
+            }
+            partial = switch_mprintf("%s%s", (stream->partial ? stream->partial : ""), jtext->valuestring);
+            switch_safe_free(stream->partial);
+            stream->partial = partial;
+
+            asr_partial_push(stream->asr_ctx, leg, stream->partial);
+        }
+    } else if(!strcmp(jtype->valuestring, "conversation.item.input_audio_transcription.completed")) {
+        if((jtext = cJSON_GetObjectItem(json, "transcript")) && jtext->type == cJSON_String && !zstr(jtext->valuestring)) {
+            asr_result_push(stream->asr_ctx, leg, jtext->valuestring);
+        }
+        if(item_id && (seg = rt_segment_lookup(stream, item_id))) {
+            seg->fl_done = SWITCH_TRUE;
+        }
+        if(item_id && !strcmp(stream->partial_id, item_id)) {
+            switch_safe_free(stream->partial);
+            stream->partial_id[0] = '\0';
+        }
+        rt_segments_release(stream);
+        stream->reconnects = 0;
+    } else if(!strcmp(jtype->valuestring, "conversation.item.input_audio_transcription.failed")) {
+        switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "Transcription failed (%s)\n", msg);
+        if(item_id && (seg = rt_segment_lookup(stream, item_id))) {
+            seg->fl_done = SWITCH_TRUE;
+        }
+        rt_segments_release(stream);
+    } else if(!strcmp(jtype->valuestring, "error")) {
+        cJSON *jerror = cJSON_GetObjectItem(json, "error");
+        cJSON *jcode = (jerror ? cJSON_GetObjectItem(jerror, "code") : NULL);
+
+        switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "Service error (%s)\n", msg);
+
+        /* the key is paused as for a 429, the next connection takes another one */
+        if(jcode && jcode->type == cJSON_String && (strstr(jcode->valuestring, "rate_limit") || strstr(jcode->valuestring, "quota"))) {
+            ratelimit_info_t info;
+
+            ratelimit_info_init(&info);
+            apikey_update(stream->globals, stream->api_key, &info, 429);
+            rt_reconnect_schedule(stream);
+        }
+    }
+
+out:
+    cJSON_Delete(json);
+}
+
+static void rt_stream_poll(rt_stream_t *stream, asr_leg_t *leg) {
+    struct curl_ws_frame *meta = NULL;
+    const void *msg = NULL;
+    char buf[4096];
+    size_t rlen = 0;
+    CURLcode ret = CURLE_OK;
+
+    if(!stream->fl_connected && !stream->fl_connecting) {
+        if((stream->segments_count || stream->open_len) && stream->reconnect_at <= switch_micro_time_now()) {
+            rt_connect(stream);
+        }
+    }
+    if(stream->fl_connecting) {
+        rt_multi_perform(stream->multi);
+    }
+    if(!stream->fl_connected) {
+        return;
+    }
+
+    if(rt_send_flush(stream) != SWITCH_STATUS_SUCCESS) {
+        rt_reconnect_schedule(stream);
+        return;
+    }
+
+    while(stream->fl_connected) {
+        if((ret = curl_ws_recv(stream->handle, buf, sizeof(buf), &rlen, &meta)) == CURLE_AGAIN) {
+            break;
+        }
+        if(ret != CURLE_OK || (meta->flags & CURLWS_CLOSE)) {
+            rt_reconnect_schedule(stream);
+            break;
+        }
+        if(!(meta->flags & (CURLWS_TEXT | CURLWS_CONT))) {
+            continue;
+        }
+
+        switch_buffer_write(stream->recv_buffer, buf, rlen);
+        if(meta->bytesleft == 0 && !(meta->flags & CURLWS_CONT)) {
+            switch_buffer_write(stream->recv_buffer, "\0", 1);
+            switch_buffer_peek_zerocopy(stream->recv_buffer, &msg);
+            rt_message_process(stream, leg, (const char *)msg);
+            switch_buffer_zero(stream->recv_buffer);
+        }
+    }
+}
+
+static void rt_stream_free(rt_stream_t **stream) {
+    if(stream && *stream) {
+        rt_disconnect(*stream);
+        if((*stream)->resampler) {
+            switch_resample_destroy(&(*stream)->resampler);
+        }
+        if((*stream)->pending) {
+            switch_buffer_destroy(&(*stream)->pending);
+        }
+        if((*stream)->recv_buffer) {
+            switch_buffer_destroy(&(*stream)->recv_buffer);
+        }
+        if((*stream)->send_buffer) {
+            switch_buffer_destroy(&(*stream)->send_buffer);
+        }
+        if((*stream)->multi && (*stream)->fl_own_multi) {
+            curl_multi_cleanup((*stream)->multi);
+        }
+        switch_safe_free(*stream);
+    }
+}
+
+static rt_stream_t *rt_stream_get(asr_ctx_t *asr_ctx, asr_leg_t *leg, globals_t *globals) {
+    rt_stream_t *stream = (rt_stream_t *)leg->stream;
+
+    if(stream) {
+        return stream;
+    }
+
+    switch_zmalloc(stream, sizeof(rt_stream_t));
+    stream->asr_ctx = asr_ctx;
+    stream->leg = leg;
+    stream->globals = globals;
+
+    if((stream->multi = asr_ctx->curl_multi) == NULL) {
+        if((stream->multi = curl_multi_init()) == NULL) {
+            switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "curl_multi_init()\n");
+            goto fail;
+        }
+        stream->fl_own_multi = SWITCH_TRUE;
+    }
+
+    if(switch_buffer_create_dynamic(&stream->pending, REALTIME_APPEND_MAX, REALTIME_APPEND_MAX, 0) != SWITCH_STATUS_SUCCESS ||
+       switch_buffer_create_dynamic(&stream->recv_buffer, 1024, 4096, 0) != SWITCH_STATUS_SUCCESS ||
+       switch_buffer_create_dynamic(&stream->send_buffer, REALTIME_APPEND_MAX, REALTIME_APPEND_MAX, 0) != SWITCH_STATUS_SUCCESS) {
+        switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "switch_buffer_create_dynamic()\n");
+        goto fail;
+    }
+    if(asr_ctx->codec == ASR_CODEC_L16 && asr_ctx->samplerate != REALTIME_SAMPLERATE) {
+        if(switch_resample_create(&stream->resampler, asr_ctx->samplerate, REALTIME_SAMPLERATE, REALTIME_APPEND_MAX, SWITCH_RESAMPLE_QUALITY, 1) != SWITCH_STATUS_SUCCESS) {
+            switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "switch_resample_create()\n");
+            goto fail;
+        }
+    }
+
+    leg->stream = stream;
+    return stream;
+
+fail:
+    rt_stream_free(&stream);
+    return NULL;
+}
+
+// ---------------------------------------------------------------------------------------------------------------------------------------------
+static switch_status_t realtime_backend_load(globals_t *globals, switch_memory_pool_t *pool) {
+    const curl_version_info_data *ver = curl_version_info(CURLVERSION_NOW);
+    const char *const *proto = NULL;
+
+    globals->realtime_url = (globals->realtime_url ? globals->realtime_url : DEF_REALTIME_URL);
+
+    for(proto = ver->protocols; proto && *proto; proto++) {
+        if(!strcasecmp(*proto, "wss") || !strcasecmp(*proto, "ws")) {
+            break;
+        }
+    }
+    if(!proto || !*proto) {
+        if(globals->backend == &backend_realtime) {
+            switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "libcurl %s has no WebSocket support\n", ver->version);
+        }
+        return SWITCH_STATUS_FALSE;
+    }
+    if(!globals->api_key) {
+        if(globals->backend == &backend_realtime) {
+            switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "Missing required parameter: api-key\n");
+        }
+        return SWITCH_STATUS_FALSE;
+    }
+
+    return SWITCH_STATUS_SUCCESS;
+}
+
+static switch_status_t realtime_backend_stream(asr_ctx_t *asr_ctx, asr_leg_t *leg, switch_byte_t *data, uint32_t data_len, globals_t *globals) {
+    rt_stream_t *stream = NULL;
+    uint32_t ofs = 0, len = 0;
+
+    if((stream = rt_stream_get(asr_ctx, leg, globals)) == NULL) {
+        return SWITCH_STATUS_FALSE;
+    }
+
+    if(data == NULL) {
+        if(!stream->open_len) {
+            return SWITCH_STATUS_SUCCESS;
+        }
+        if(stream->segments_count == REALTIME_SEGMENTS_MAX) {
+            switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_WARNING, "Too many utterances awaiting the transcript, dropping the oldest one\n");
+            stream->segments[0].fl_done = SWITCH_TRUE;
+            rt_segments_release(stream);
+        }
+        memset(&stream->segments[stream->segments_count], 0, sizeof(rt_segment_t));
+        stream->segments[stream->segments_count++].len = stream->open_len;
+        stream->open_len = 0;
+
+        if(stream->fl_connected && rt_send_type(stream, "input_audio_buffer.commit") != SWITCH_STATUS_SUCCESS) {
+            rt_reconnect_schedule(stream);
+        }
+        return SWITCH_STATUS_SUCCESS;
+    }
+
+    for(ofs = 0; ofs < data_len; ofs += len) {
+        const switch_byte_t *chunk = data + ofs;
+        uint32_t chunk_len = len = MIN(data_len - ofs, REALTIME_APPEND_MAX);
+
+        if(stream->resampler) {
+            switch_resample_process(stream->resampler, (int16_t *)chunk, (chunk_len / sizeof(int16_t)));
+            chunk = (switch_byte_t *)stream->resampler->to;
+            chunk_len = (stream->resampler->to_len * sizeof(int16_t));
+        }
+
+        switch_buffer_write(stream->pending, chunk, chunk_len);
+        stream->open_len += chunk_len;
+
+        if(stream->fl_connected && rt_send_append(stream, chunk, chunk_len) != SWITCH_STATUS_SUCCESS) {
+            rt_reconnect_schedule(stream);
+        }
+    }
+
+    /* the first frames of the session open the connection, the rest is sent right away */
+    if(!stream->fl_connected) {
+        rt_stream_poll(stream, leg);
+    }
+
+    return SWITCH_STATUS_SUCCESS;
+}
+
+static void realtime_backend_poll(asr_ctx_t *asr_ctx, globals_t *globals) {
+    uint32_t i = 0;
+
+    for(i = 0; i < asr_ctx->legs_count; i++) {
+        if(asr_ctx->legs[i].stream) {
+            rt_stream_poll((rt_stream_t *)asr_ctx->legs[i].stream, &asr_ctx->legs[i]);
+        }
+    }
+}
+
+static void realtime_backend_close(asr_ctx_t *asr_ctx) {
+    uint32_t i = 0;
+
+    for(i = 0; i < asr_ctx->legs_count; i++) {
+        rt_stream_free((rt_stream_t **)&asr_ctx->legs[i].stream);
+    }
+}
+
+/* a whole utterance at once (openai_asr_bench), waits for its transcript */
+static switch_status_t realtime_backend_transcribe(asr_ctx_t *asr_ctx, asr_leg_t *leg, switch_byte_t *data, uint32_t data_len, globals_t *globals) {
+    switch_time_t deadline = switch_micro_time_now() + ((globals->request_timeout > 0 ? globals->request_timeout : 60) * 1000000);
+    rt_stream_t *stream = NULL;
+
+    if(realtime_backend_stream(asr_ctx, leg, data, data_len, globals) != SWITCH_STATUS_SUCCESS || realtime_backend_stream(asr_ctx, leg, NULL, 0, globals) != SWITCH_STATUS_SUCCESS) {
+        return SWITCH_STATUS_FALSE;
+    }
+
+    stream = (rt_stream_t *)leg->stream;
+    while(stream->segments_count > 0) {
+        if(globals->fl_shutdown || asr_ctx->fl_destroyed || asr_ctx->fl_abort || switch_micro_time_now() >= deadline) {
+            return SWITCH_STATUS_FALSE;
+        }
+        rt_stream_poll(stream, leg);
+        curl_multi_poll(stream->multi, NULL, 0, 10, NULL);
+    }
+
+    return SWITCH_STATUS_SUCCESS;
+}
+
+asr_backend_t backend_realtime = {
+    "realtime",
+    realtime_backend_load,
+    NULL,
+    realtime_backend_transcribe,
+    NULL,
+    realtime_backend_stream,
+    realtime_backend_poll,
+    realtime_backend_close
+};
@@ -0,0 +1,406 @@
+/*
+ * FreeSWITCH Modular Media Switching Software Library / Soft-Switch Application
+ * Copyright (C) 2005-2014, Anthony Minessale II <anthm@freeswitch.org>
+ *
+ * Version: MPL 1.1
+ *
+ * The contents of this file are subject to the Mozilla Public License Version
+ * 1.1 (the "License"); you may not use this file except in compliance with
+ * the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS" basis,
+ * WITHOUT WARRANTY OF ANY KIND, either express or implied. See the License
+ * for the specific language governing rights and limitations under the
+ * License.
+ *
+ * Module Contributor(s):
+ *  Konstantin Alexandrin <akscfx@gmail.com>
+ *
+ *
+ * backend_whisper.c -- in-process whisper.cpp backend
+ *
+ * The model is loaded once on module load and shared by all the sessions,
+ * utterances are queued to a fixed pool of inference threads (each one keeps its own whisper state).
+ * Built only with -DHAVE_WHISPER (see Makefile.am), otherwise the backend refuses to load.
+ *
+ */
+#include "mod_openai_asr.h"
+
+#ifdef HAVE_WHISPER
+#include <whisper.h>
+
+#define WHISPER_SAMPLERATE      16000
+#define WHISPER_WORKERS_MAX     32
+
+typedef struct {
+    float                   *samples;
+    uint32_t                samples_count;
+    char                    *text;
+    char                    lang[8];
+    float                   lang_probability;
+    uint8_t                 fl_lang_detect;     // the session wants the detection confidence
+    uint8_t                 fl_done;
+    uint8_t                 fl_abandoned;       // the session has gone, the worker frees the job
+} whisper_job_t;
+
+static struct {
+    switch_mutex_t          *mutex;
+    switch_thread_cond_t    *cond;
+    switch_queue_t          *q_jobs;
+    switch_thread_t         *threads[WHISPER_WORKERS_MAX];
+    struct whisper_context  *wctx;
+    uint32_t                threads_count;
+    uint32_t                threads_running;    // the ones that got their whisper state
+    uint32_t                inference_threads;
+    uint8_t                 fl_loaded;
+    uint8_t                 fl_shutdown;
+} wglobals;
+
+static void whisper_backend_unload(globals_t *globals);
+
+static void whisper_job_free(whisper_job_t **job) {
+    if(job && *job) {
+        switch_safe_free((*job)->samples);
+        switch_safe_free((*job)->text);
+        free(*job);
+        *job = NULL;
+    }
+}
+
+static void whisper_job_run(struct whisper_state *wstate, whisper_job_t *job) {
+    struct whisper_full_params wparams = whisper_full_default_params(WHISPER_SAMPLING_GREEDY);
+    switch_buffer_t *text_buffer = NULL;
+    const void *ptr = NULL;
+    int i = 0, segments = 0, lang_id = -1;
+
+    wparams.n_threads = wglobals.inference_threads;
+    wparams.language = (job->lang[0] ? job->lang : "auto");
+    wparams.translate = false;
+    wparams.no_context = true;
+    wparams.print_realtime = false;
+    wparams.print_progress = false;
+    wparams.print_timestamps = false;
+    wparams.print_special = false;
+
+    if(whisper_full_with_state(wglobals.wctx, wstate, wparams, job->samples, job->samples_count) != 0) {
+        switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "whisper_full_with_state()\n");
+        return;
+    }
+
+    if(switch_buffer_create_dynamic(&text_buffer, 256, 512, 0) != SWITCH_STATUS_SUCCESS) {
+        return;
+    }
+    segments = whisper_full_n_segments_from_state(wstate);
+    for(i = 0; i < segments; i++) {
+        const char *text = whisper_full_get_segment_text_from_state(wstate, i);
+        if(text) {
+            switch_buffer_write(text_buffer, text, strlen(text));
+        }
+    }
+    switch_buffer_write(text_buffer, "\0", 1);
+    if(switch_buffer_peek_zerocopy(text_buffer, &ptr) && ptr) {
+        job->text = strdup((char *)ptr);
+    }
+    switch_buffer_destroy(&text_buffer);
+
+    if(!job->lang[0] && (lang_id = whisper_full_lang_id_from_state(wstate)) >= 0) {
+        switch_copy_string(job->lang, whisper_lang_str(lang_id), sizeof(job->lang));
+
+        /* whisper_full() doesn't keep the probabilities, the mel is still in the state so only the encoder runs again */
+        if(job->fl_lang_detect) {
+            float *lang_probs = NULL;
+
+            switch_zmalloc(lang_probs, (whisper_lang_max_id() + 1) * sizeof(float));
+            if(whisper_lang_auto_detect_with_state(wglobals.wctx, wstate, 0, wglobals.inference_threads, lang_probs) >= 0) {
+                job->lang_probability = lang_probs[lang_id];
+            }
+            switch_safe_free(lang_probs);
+        }
+    }
+}
+
+static void *SWITCH_THREAD_FUNC whisper_worker_thread(switch_thread_t *thread, void *obj) {
+    struct whisper_state *wstate = NULL;
+    void *pop = NULL;
+
+    if((wstate = whisper_init_state(wglobals.wctx)) == NULL) {
+        switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "whisper_init_state()\n");
+        return NULL;
+    }
+
+    switch_mutex_lock(wglobals.mutex);
+    wglobals.threads_running++;
+    switch_mutex_unlock(wglobals.mutex);
+
+    while(!wglobals.fl_shutdown) {
+        whisper_job_t *job = NULL;
+
+        if(switch_queue_pop_timeout(wglobals.q_jobs, &pop, 100000) != SWITCH_STATUS_SUCCESS || !pop) {
+            continue;
+        }
+        job = (whisper_job_t *)pop;
+
+        switch_mutex_lock(wglobals.mutex);
+        if(job->fl_abandoned) {
+            whisper_job_free(&job);
+        }
+        switch_mutex_unlock(wglobals.mutex);
+        if(!job) {
+            continue;
+        }
+
+        whisper_job_run(wstate, job);
+
+        switch_mutex_lock(wglobals.mutex);
+        if(job->fl_abandoned) {
+            whisper_job_free(&job);
+        } else {
+            job->fl_done = SWITCH_TRUE;
+        }
+        switch_thread_cond_broadcast(wglobals.cond);
+        switch_mutex_unlock(wglobals.mutex);
+    }
+
+    switch_mutex_lock(wglobals.mutex);
+    wglobals.threads_running--;
+    switch_mutex_unlock(wglobals.mutex);
+
+    whisper_free_state(wstate);
+    return NULL;
+}
+
+/* whisper expects 16kHz float mono */
+static switch_status_t whisper_samples_convert(asr_ctx_t *asr_ctx, switch_byte_t *data, uint32_t data_len, float **out, uint32_t *out_len) {
+    switch_audio_resampler_t *resampler = NULL;
+    int16_t *pcm = (int16_t *)data, *g711_pcm = NULL;
+    uint32_t samples = (data_len / sizeof(int16_t)), i = 0;
+    float *result = NULL;
+
+    if(asr_ctx->codec != ASR_CODEC_L16) {
+        switch_malloc(g711_pcm, data_len * sizeof(int16_t));
+        g711_decode(asr_ctx->codec, data, data_len, g711_pcm);
+        pcm = g711_pcm;
+        samples = data_len;
+        data_len *= sizeof(int16_t);
+    }
+
+    if(asr_ctx->samplerate != WHISPER_SAMPLERATE) {
+        if(switch_resample_create(&resampler, asr_ctx->samplerate, WHISPER_SAMPLERATE, data_len, SWITCH_RESAMPLE_QUALITY, 1) != SWITCH_STATUS_SUCCESS) {
+            switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "switch_resample_create()\n");
+            switch_safe_free(g711_pcm);
+            return SWITCH_STATUS_FALSE;
+        }
+        switch_resample_process(resampler, pcm, samples);
+        pcm = resampler->to;
+        samples = resampler->to_len;
+    }
+
+    switch_malloc(result, (samples * sizeof(float)));
+    for(i = 0; i < samples; i++) {
+        result[i] = (float)pcm[i] / 32768.0f;
+    }
+
+    if(resampler) {
+        switch_resample_destroy(&resampler);
+    }
+    switch_safe_free(g711_pcm);
+
+    *out = result;
+    *out_len = samples;
+    return SWITCH_STATUS_SUCCESS;
+}
+
+static switch_status_t whisper_backend_transcribe(asr_ctx_t *asr_ctx, asr_leg_t *leg, switch_byte_t *data, uint32_t data_len, globals_t *globals) {
+    switch_status_t status = SWITCH_STATUS_FALSE;
+    switch_time_t deadline = switch_micro_time_now() + ((switch_time_t)(globals->request_timeout > 0 ? globals->request_timeout : 60) * 1000000);
+    whisper_job_t *job = NULL;
+    const char *lang = NULL;
+    switch_bool_t fl_stale = SWITCH_FALSE;
+
+    if(!wglobals.fl_loaded) {
+        switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "whisper backend isn't loaded (whisper-model)\n");
+        return SWITCH_STATUS_FALSE;
+    }
+    if(!wglobals.threads_running) {
+        switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "whisper backend has no running workers\n");
+        return SWITCH_STATUS_FALSE;
+    }
+
+    switch_zmalloc(job, sizeof(whisper_job_t));
+    if(whisper_samples_convert(asr_ctx, data, data_len, &job->samples, &job->samples_count) != SWITCH_STATUS_SUCCESS) {
+        whisper_job_free(&job);
+        return SWITCH_STATUS_FALSE;
+    }
+    if((lang = lang_request_language(asr_ctx, leg, globals))) {
+        switch_copy_string(job->lang, lang, sizeof(job->lang));
+    }
+    job->fl_lang_detect = lang_detect_required(asr_ctx, leg, globals);
+
+    if(switch_queue_trypush(wglobals.q_jobs, job) != SWITCH_STATUS_SUCCESS) {
+        switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "whisper queue is full\n");
+        whisper_job_free(&job);
+        return SWITCH_STATUS_FALSE;
+    }
+
+    switch_mutex_lock(wglobals.mutex);
+    while(!job->fl_done) {
+        /* asr_ctx->mutex is never taken under wglobals.mutex, asr_ctx_destroy() locks them the other way round */
+        switch_mutex_unlock(wglobals.mutex);
+        fl_stale = speculation_stale(asr_ctx, leg);
+        switch_mutex_lock(wglobals.mutex);
+
+        if(job->fl_done) {
+            break;
+        }
+        if(globals->fl_shutdown || asr_ctx->fl_destroyed || fl_stale) {
+            job->fl_abandoned = SWITCH_TRUE;
+            job = NULL;
+            break;
+        }
+        if(switch_micro_time_now() >= deadline) {
+            switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "whisper job timed out (%d sec)\n", (globals->request_timeout > 0 ? globals->request_timeout : 60));
+            job->fl_abandoned = SWITCH_TRUE;
+            job = NULL;
+            break;
+        }
+        switch_thread_cond_timedwait(wglobals.cond, wglobals.mutex, 100000);
+    }
+    switch_mutex_unlock(wglobals.mutex);
+
+    if(job) {
+        if(job->lang[0]) {
+            response_t response = { 0 };
+
+            switch_copy_string(response.language, job->lang, sizeof(response.language));
+            response.language_probability = job->lang_probability;
+            response.fl_language_probability = SWITCH_TRUE;
+            lang_detect_update(asr_ctx, leg, &response, globals);
+        }
+        if(job->text) {
+            asr_result_take(asr_ctx, leg, job->text);
+            job->text = NULL;
+            status = SWITCH_STATUS_SUCCESS;
+        }
+        whisper_job_free(&job);
+    }
+
+    return status;
+}
+
+static void whisper_backend_wakeup(asr_ctx_t *asr_ctx) {
+    if(wglobals.fl_loaded) {
+        switch_mutex_lock(wglobals.mutex);
+        switch_thread_cond_broadcast(wglobals.cond);
+        switch_mutex_unlock(wglobals.mutex);
+    }
+}
+
+static switch_status_t whisper_backend_load(globals_t *globals, switch_memory_pool_t *pool) {
+    struct whisper_context_params cparams = whisper_context_default_params();
+    switch_threadattr_t *attr = NULL;
+    uint32_t cores = MAX(switch_core_cpu_count(), 1), i = 0;
+
+    if(zstr(globals->whisper_model)) {
+        return SWITCH_STATUS_FALSE;
+    }
+
+    memset(&wglobals, 0, sizeof(wglobals));
+    switch_mutex_init(&wglobals.mutex, SWITCH_MUTEX_NESTED, pool);
+    switch_thread_cond_create(&wglobals.cond, pool);
+    switch_queue_create(&wglobals.q_jobs, QUEUE_SIZE, pool);
+
+    cparams.use_gpu = false;
+    if((wglobals.wctx = whisper_init_from_file_with_params(globals->whisper_model, cparams)) == NULL) {
+        switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "Unable to load whisper model: %s\n", globals->whisper_model);
+        return SWITCH_STATUS_FALSE;
+    }
+
+    /* by default every worker gets 4 cores */
+    wglobals.threads_count = (globals->whisper_workers ? globals->whisper_workers : MAX(cores / 4, 1));
+    wglobals.threads_count = MIN(wglobals.threads_count, WHISPER_WORKERS_MAX);
+    wglobals.inference_threads = (globals->whisper_threads ? globals->whisper_threads : MAX(cores / wglobals.threads_count, 1));
+
+    switch_threadattr_create(&attr, pool);
+    switch_threadattr_stacksize_set(attr, SWITCH_THREAD_STACKSIZE);
+    for(i = 0; i < wglobals.threads_count; i++) {
+        if(switch_thread_create(&wglobals.threads[i], attr, whisper_worker_thread, NULL, pool) != SWITCH_STATUS_SUCCESS) {
+            switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "Unable to start whisper worker %d\n", i);
+            wglobals.threads[i] = NULL;
+            break;
+        }
+    }
+
+    /* give the workers a moment to allocate their states, a pool without them would only time out the sessions */
+    for(i = 0; i < 500 && !wglobals.threads_running; i++) {
+        switch_yield(10000);
+    }
+    if(!wglobals.threads_running) {
+        switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "No whisper worker came up\n");
+        whisper_backend_unload(globals);
+        return SWITCH_STATUS_FALSE;
+    }
+
+    wglobals.fl_loaded = SWITCH_TRUE;
+
+    switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_NOTICE, "whisper model loaded: %s (workers=%d, threads=%d)\n", globals->whisper_model, wglobals.threads_count, wglobals.inference_threads);
+    return SWITCH_STATUS_SUCCESS;
+}
+
+static void whisper_backend_unload(globals_t *globals) {
+    switch_status_t st = SWITCH_STATUS_SUCCESS;
+    void *pop = NULL;
+    uint32_t i = 0;
+
+    if(!wglobals.wctx) {
+        return;
+    }
+
+    wglobals.fl_shutdown = SWITCH_TRUE;
+    for(i = 0; i < wglobals.threads_count; i++) {
+        if(wglobals.threads[i]) {
+            switch_thread_join(&st, wglobals.threads[i]);
+        }
+    }
+    while(switch_queue_trypop(wglobals.q_jobs, &pop) == SWITCH_STATUS_SUCCESS) {
+        whisper_job_t *job = (whisper_job_t *)pop;
+        if(job && job->fl_abandoned) { whisper_job_free(&job); }
+    }
+
+    whisper_free(wglobals.wctx);
+    wglobals.wctx = NULL;
+    wglobals.fl_loaded = SWITCH_FALSE;
+}
+
+#else
+
+static switch_status_t whisper_backend_load(globals_t *globals, switch_memory_pool_t *pool) {
+    if(!zstr(globals->whisper_model)) {
+        switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "The module was built without whisper.cpp support\n");
+    }
+    return SWITCH_STATUS_FALSE;
+}
+
+static void whisper_backend_unload(globals_t *globals) {
+}
+
+static void whisper_backend_wakeup(asr_ctx_t *asr_ctx) {
+}
+
+static switch_status_t whisper_backend_transcribe(asr_ctx_t *asr_ctx, asr_leg_t *leg, switch_byte_t *data, uint32_t data_len, globals_t *globals) {
+    switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "The module was built without whisper.cpp support\n");
+    return SWITCH_STATUS_FALSE;
+}
+
+#endif
+
+asr_backend_t backend_whisper = {
+    "whisper",
+    whisper_backend_load,
+    whisper_backend_unload,
+    whisper_backend_transcribe,
+    whisper_backend_wakeup,
+    NULL,
+    NULL,
+    NULL
+};
@@ -0,0 +1,332 @@
+/*
+ * FreeSWITCH Modular Media Switching Software Library / Soft-Switch Application
+ * Copyright (C) 2005-2014, Anthony Minessale II <anthm@freeswitch.org>
+ *
+ * Version: MPL 1.1
+ *
+ * The contents of this file are subject to the Mozilla Public License Version
+ * 1.1 (the "License"); you may not use this file except in compliance with
+ * the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS" basis,
+ * WITHOUT WARRANTY OF ANY KIND, either express or implied. See the License
+ * for the specific language governing rights and limitations under the
+ * License.
+ *
+ * Module Contributor(s):
+ *  Konstantin Alexandrin <akscfx@gmail.com>
+ *
+ *
+ * capture.c -- session capture for openai_asr_replay
+ *
+ * Every fed frame is appended as it comes, with its arrival time and the VAD decision it led to.
+ * The file is meant to be mmap()ed back, so it's in host byte order and the records are 8-byte aligned:
+ *
+ *  header:   "OACP" | version:u16 | codec:u8 | legs:u8 | samplerate:u32 | reserved:u32 | started:u64 | index_offset:u64
+ *  record:   ts:u64 | len:u32 | leg:u8 | vad:u8 | reserved:u16 | data, padded to 8
+ *  index:    "OAIX" | count:u32 | records:u64 | { ts:u64 | offset:u64 } * count
+ *
+ * The index (every CAPTURE_INDEX_STEP records) is written when the session closes and its offset is
+ * patched into the header; a capture without it (crash) can still be read through, just not seeked.
+ *
+ */
+#include "mod_openai_asr.h"
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+
+#define CAPTURE_MAGIC           "OACP"
+#define CAPTURE_INDEX_MAGIC     "OAIX"
+#define CAPTURE_VERSION         1
+#define CAPTURE_INDEX_STEP      50
+#define CAPTURE_ALIGN(x)        (((x) + 7) & ~((uint64_t)7))
+
+typedef struct {
+    char                    magic[4];
+    uint16_t                version;
+    uint8_t                 codec;
+    uint8_t                 legs;
+    uint32_t                samplerate;
+    uint32_t                reserved;
+    uint64_t                started;            // epoch, us
+    uint64_t                index_offset;       // 0 - not closed
+} capture_hdr_t;
+
+typedef struct {
+    uint64_t                ts;
+    uint32_t                len;
+    uint8_t                 leg;
+    uint8_t                 vad;
+    uint16_t                reserved;
+} capture_rec_t;
+
+typedef struct {
+    char                    magic[4];
+    uint32_t                count;
+    uint64_t                records;
+} capture_index_hdr_t;
+
+typedef struct {
+    uint64_t                ts;
+    uint64_t                offset;
+} capture_index_entry_t;
+
+struct capture_s {
+    switch_mutex_t          *mutex;             // the native taps feed the legs from different threads
+    FILE                    *fp;
+    char                    *path;
+    capture_hdr_t           hdr;
+    capture_index_entry_t   *index;
+    uint32_t                index_count;
+    uint32_t                index_size;
+    uint64_t                records;
+    uint64_t                offset;
+    uint8_t                 fl_failed;
+};
+
+static const uint8_t zero_pad[8] = { 0 };
+
+capture_t *capture_open(asr_ctx_t *asr_ctx, globals_t *globals) {
+    capture_t *cap = NULL;
+    char uuid[SWITCH_UUID_FORMATTED_LENGTH + 1] = { 0 };
+
+    switch_zmalloc(cap, sizeof(capture_t));
+
+    if(switch_mutex_init(&cap->mutex, SWITCH_MUTEX_NESTED, asr_ctx->pool) != SWITCH_STATUS_SUCCESS) {
+        switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "switch_mutex_init()\n");
+        goto fail;
+    }
+
+    if(switch_directory_exists(globals->capture_path, NULL) != SWITCH_STATUS_SUCCESS) {
+        switch_dir_make(globals->capture_path, SWITCH_FPROT_OS_DEFAULT, NULL);
+    }
+    if(zstr(asr_ctx->session_uuid)) {
+        switch_uuid_str(uuid, sizeof(uuid));
+    }
+    cap->path = switch_mprintf("%s%s%s.%s", globals->capture_path, SWITCH_PATH_SEPARATOR, (zstr(asr_ctx->session_uuid) ? uuid : asr_ctx->session_uuid), CAPTURE_FILE_EXT);
+
+    if((cap->fp = fopen(cap->path, "wb")) == NULL) {
+        switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "Unable to create capture (%s)\n", cap->path);
+        goto fail;
+    }
+
+    memcpy(cap->hdr.magic, CAPTURE_MAGIC, sizeof(cap->hdr.magic));
+    cap->hdr.version = CAPTURE_VERSION;
+    cap->hdr.codec = asr_ctx->codec;
+    cap->hdr.legs = asr_ctx->legs_count;
+    cap->hdr.samplerate = asr_ctx->samplerate;
+    cap->hdr.started = switch_micro_time_now();
+
+    if(fwrite(&cap->hdr, sizeof(cap->hdr), 1, cap->fp) != 1) {
+        switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "Unable to write capture (%s)\n", cap->path);
+        goto fail;
+    }
+    cap->offset = sizeof(cap->hdr);
+
+    switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_DEBUG, "Capturing to %s\n", cap->path);
+    return cap;
+
+fail:
+    if(cap->fp) {
+        fclose(cap->fp);
+        unlink(cap->path);
+    }
+    switch_safe_free(cap->path);
+    switch_safe_free(cap);
+    return NULL;
+}
+
+void capture_write(capture_t *cap, uint32_t leg, const void *data, uint32_t data_len, switch_vad_state_t vad_state) {
+    capture_rec_t rec = { 0 };
+    uint64_t pad = 0;
+
+    if(!cap || !data || !data_len) {
+        return;
+    }
+
+    rec.len = data_len;
+    rec.leg = leg;
+    rec.vad = vad_state;
+    pad = CAPTURE_ALIGN(data_len) - data_len;
+
+    switch_mutex_lock(cap->mutex);
+    if(cap->fl_failed) {
+        goto out;
+    }
+
+    /* taken under the lock, so the records of both legs (and the index) are in time order */
+    rec.ts = (switch_micro_time_now() - cap->hdr.started);
+
+    if(cap->records % CAPTURE_INDEX_STEP == 0) {
+        if(cap->index_count >= cap->index_size) {
+            capture_index_entry_t *index = NULL;
+            uint32_t size = (cap->index_size ? cap->index_size * 2 : 64);
+
+            if((index = realloc(cap->index, size * sizeof(capture_index_entry_t))) == NULL) {
+                goto index_skip;
+            }
+            cap->index = index;
+            cap->index_size = size;
+        }
+        cap->index[cap->index_count].ts = rec.ts;
+        cap->index[cap->index_count].offset = cap->offset;
+        cap->index_count++;
+    }
+    index_skip:
+
+    if(fwrite(&rec, sizeof(rec), 1, cap->fp) != 1 || fwrite(data, data_len, 1, cap->fp) != 1 || (pad && fwrite(zero_pad, pad, 1, cap->fp) != 1)) {
+        switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "Unable to write capture (%s), stopped\n", cap->path);
+        cap->fl_failed = SWITCH_TRUE;
+        goto out;
+    }
+    cap->offset += (sizeof(rec) + data_len + pad);
+    cap->records++;
+
+out:
+    switch_mutex_unlock(cap->mutex);
+}
+
+void capture_close(capture_t **cap_ref) {
+    capture_t *cap = (cap_ref ? *cap_ref : NULL);
+    capture_index_hdr_t ihdr = { 0 };
+
+    if(!cap) {
+        return;
+    }
+
+    if(!cap->fl_failed) {
+        memcpy(ihdr.magic, CAPTURE_INDEX_MAGIC, sizeof(ihdr.magic));
+        ihdr.count = cap->index_count;
+        ihdr.records = cap->records;
+
+        if(fwrite(&ihdr, sizeof(ihdr), 1, cap->fp) == 1 && (!cap->index_count || fwrite(cap->index, sizeof(capture_index_entry_t), cap->index_count, cap->fp) == cap->index_count)) {
+            cap->hdr.index_offset = cap->offset;
+            if(fseek(cap->fp, 0, SEEK_SET) != 0 || fwrite(&cap->hdr, sizeof(cap->hdr), 1, cap->fp) != 1) {
+                switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_WARNING, "Unable to index capture (%s)\n", cap->path);
+            }
+        }
+    }
+    fclose(cap->fp);
+
+    switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_DEBUG, "Capture closed: %s (%u frames)\n", cap->path, (uint32_t)cap->records);
+
+    switch_safe_free(cap->index);
+    switch_safe_free(cap->path);
+    switch_safe_free(cap);
+    *cap_ref = NULL;
+}
+
+// ---------------------------------------------------------------------------------------------------------------------------------------------
+switch_status_t capture_reader_open(capture_reader_t *rd, const char *path) {
+    const capture_hdr_t *hdr = NULL;
+    const capture_index_hdr_t *ihdr = NULL;
+    struct stat st = { 0 };
+    void *base = NULL;
+    int fd = -1;
+
+    memset(rd, 0, sizeof(*rd));
+
+    if((fd = open(path, O_RDONLY)) < 0 || fstat(fd, &st) != 0) {
+        switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "Unable to open capture (%s)\n", path);
+        goto fail;
+    }
+    if((switch_size_t)st.st_size < sizeof(capture_hdr_t)) {
+        switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "Not a capture (%s)\n", path);
+        goto fail;
+    }
+    if((base = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0)) == MAP_FAILED) {
+        switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "mmap() failed (%s)\n", path);
+        goto fail;
+    }
+    close(fd);
+    fd = -1;
+
+    rd->base = base;
+    rd->size = st.st_size;
+    hdr = (const capture_hdr_t *)rd->base;
+
+    if(memcmp(hdr->magic, CAPTURE_MAGIC, sizeof(hdr->magic)) || hdr->version != CAPTURE_VERSION || !g711_codec_name(hdr->codec) || !hdr->legs || hdr->legs > ASR_LEGS_MAX || !hdr->samplerate) {
+        switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "Not a capture or unsupported version (%s)\n", path);
+        goto fail;
+    }
+
+    rd->codec = hdr->codec;
+    rd->legs = hdr->legs;
+    rd->samplerate = hdr->samplerate;
+    rd->offset = sizeof(capture_hdr_t);
+    rd->end = rd->size;
+
+    if(hdr->index_offset && hdr->index_offset + sizeof(capture_index_hdr_t) <= rd->size) {
+        ihdr = (const capture_index_hdr_t *)(rd->base + hdr->index_offset);
+        if(!memcmp(ihdr->magic, CAPTURE_INDEX_MAGIC, sizeof(ihdr->magic)) && hdr->index_offset + sizeof(capture_index_hdr_t) + (uint64_t)ihdr->count * sizeof(capture_index_entry_t) <= rd->size) {
+            rd->end = hdr->index_offset;
+            rd->index = (ihdr + 1);
+            rd->index_count = ihdr->count;
+        }
+    }
+    if(!rd->index) {
+        switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_WARNING, "Capture wasn't closed, reading through (%s)\n", path);
+    }
+
+    return SWITCH_STATUS_SUCCESS;
+
+fail:
+    if(fd >= 0) {
+        close(fd);
+    }
+    capture_reader_close(rd);
+    return SWITCH_STATUS_FALSE;
+}
+
+switch_bool_t capture_reader_next(capture_reader_t *rd, capture_frame_t *frame) {
+    const capture_rec_t *rec = NULL;
+
+    if(rd->offset + sizeof(capture_rec_t) > rd->end) {
+        return SWITCH_FALSE;
+    }
+    rec = (const capture_rec_t *)(rd->base + rd->offset);
+
+    /* a torn tail of an unclosed capture */
+    if(rd->offset + sizeof(capture_rec_t) + rec->len > rd->end || rec->leg >= rd->legs) {
+        rd->offset = rd->end;
+        return SWITCH_FALSE;
+    }
+
+    frame->ts = rec->ts;
+    frame->len = rec->len;
+    frame->leg = rec->leg;
+    frame->vad = rec->vad;
+    frame->data = (const switch_byte_t *)(rec + 1);
+
+    rd->offset += sizeof(capture_rec_t) + CAPTURE_ALIGN(rec->len);
+    return SWITCH_TRUE;
+}
+
+/* to the indexed record at or before 'ts', the records are in arrival order */
+void capture_reader_seek(capture_reader_t *rd, uint64_t ts) {
+    const capture_index_entry_t *index = (const capture_index_entry_t *)rd->index;
+    uint32_t lo = 0, hi = rd->index_count;
+
+    if(!index || !rd->index_count || index[0].ts > ts) {
+        return;
+    }
+    while(hi - lo > 1) {
+        uint32_t mid = (lo + hi) / 2;
+        if(index[mid].ts <= ts) {
+            lo = mid;
+        } else {
+            hi = mid;
+        }
+    }
+    if(index[lo].offset >= sizeof(capture_hdr_t) && index[lo].offset < rd->end) {
+        rd->offset = index[lo].offset;
+    }
+}
+
+void capture_reader_close(capture_reader_t *rd) {
+    if(rd->base) {
+        munmap((void *)rd->base, rd->size);
+    }
+    memset(rd, 0, sizeof(*rd));
+}
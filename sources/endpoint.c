@@ -0,0 +1,160 @@
+/*
+ * FreeSWITCH Modular Media Switching Software Library / Soft-Switch Application
+ * Copyright (C) 2005-2014, Anthony Minessale II <anthm@freeswitch.org>
+ *
+ * Version: MPL 1.1
+ *
+ * The contents of this file are subject to the Mozilla Public License Version
+ * 1.1 (the "License"); you may not use this file except in compliance with
+ * the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS" basis,
+ * WITHOUT WARRANTY OF ANY KIND, either express or implied. See the License
+ * for the specific language governing rights and limitations under the
+ * License.
+ *
+ * Module Contributor(s):
+ *  Konstantin Alexandrin <akscfx@gmail.com>
+ *
+ *
+ * endpoint.c -- service endpoints health and latency tracking
+ *
+ * Every endpoint has a circuit breaker: it opens after 'breaker-failures' consecutive
+ * errors and after 'breaker-open-ms' lets a single probe request through (half-open).
+ * Latency of the successful requests is kept in a window to compute the hedging delay.
+ *
+ */
+#include "mod_openai_asr.h"
+
+static int latency_cmp(const void *a, const void *b) {
+    uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+    return (x < y ? -1 : (x > y ? 1 : 0));
+}
+
+/* 'unix:/path/to.sock[:/request/path]' talks http over a unix domain socket */
+switch_status_t endpoint_add(globals_t *globals, switch_memory_pool_t *pool, const char *url) {
+    endpoint_t *endpoint = NULL;
+    const char *socket_path = NULL;
+    char *p = NULL;
+
+    if(globals->endpoints_count >= ENDPOINTS_MAX) {
+        switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_WARNING, "Too many endpoints, ignoring: %s\n", url);
+        return SWITCH_STATUS_FALSE;
+    }
+
+    if(strncasecmp(url, "unix:", 5) == 0) {
+        socket_path = p = switch_core_strdup(pool, url + 5);
+        if(zstr(socket_path)) {
+            switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_WARNING, "Missing socket path, ignoring: %s\n", url);
+            return SWITCH_STATUS_FALSE;
+        }
+        if((p = strstr(p, ":/"))) {
+            *p++ = '\0';
+        }
+        url = switch_core_sprintf(pool, "http://localhost%s", (p ? p : DEF_UNIX_REQUEST_PATH));
+    }
+
+    endpoint = &globals->endpoints[globals->endpoints_count++];
+    endpoint->url = url;
+    endpoint->socket_path = socket_path;
+    endpoint->state = EP_STATE_CLOSED;
+    endpoint->failures = 0;
+    endpoint->fl_probe = SWITCH_FALSE;
+
+    return SWITCH_STATUS_SUCCESS;
+}
+
+/*
+ * picks the first usable endpoint in the configuration order,
+ * 'exclude' is skipped unless nothing else is available (hedging to the same endpoint goes over a new connection)
+ */
+endpoint_t *endpoint_acquire(globals_t *globals, endpoint_t *exclude) {
+    endpoint_t *result = NULL;
+    switch_time_t now = switch_micro_time_now();
+    uint32_t i = 0;
+
+    switch_mutex_lock(globals->mutex);
+    for(i = 0; i < globals->endpoints_count; i++) {
+        endpoint_t *endpoint = &globals->endpoints[i];
+
+        if(endpoint == exclude) {
+            continue;
+        }
+        if(endpoint->state == EP_STATE_OPEN && endpoint->open_until <= now) {
+            endpoint->state = EP_STATE_HALF_OPEN;
+            endpoint->fl_probe = SWITCH_FALSE;
+        }
+        if(endpoint->state == EP_STATE_CLOSED) {
+            result = endpoint;
+            break;
+        }
+        if(endpoint->state == EP_STATE_HALF_OPEN && !endpoint->fl_probe) {
+            endpoint->fl_probe = SWITCH_TRUE;
+            result = endpoint;
+            break;
+        }
+    }
+    if(!result && exclude && exclude->state == EP_STATE_CLOSED) {
+        result = exclude;
+    }
+    switch_mutex_unlock(globals->mutex);
+
+    return result;
+}
+
+void endpoint_report(globals_t *globals, endpoint_t *endpoint, endpoint_result_t result, uint32_t latency_ms) {
+    if(!endpoint) {
+        return;
+    }
+
+    switch_mutex_lock(globals->mutex);
+    if(endpoint->state == EP_STATE_HALF_OPEN) {
+        endpoint->fl_probe = SWITCH_FALSE;
+    }
+
+    if(result == EP_RESULT_SUCCESS) {
+        if(endpoint->state != EP_STATE_CLOSED) {
+            switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_NOTICE, "Endpoint recovered: %s\n", endpoint->url);
+        }
+        endpoint->state = EP_STATE_CLOSED;
+        endpoint->failures = 0;
+
+        globals->latency_ms[globals->latency_pos] = latency_ms;
+        globals->latency_pos = (globals->latency_pos + 1) % LATENCY_WINDOW;
+        if(globals->latency_count < LATENCY_WINDOW) { globals->latency_count++; }
+
+    } else if(result == EP_RESULT_FAILURE) {
+        endpoint->failures++;
+        if(endpoint->state == EP_STATE_HALF_OPEN || (endpoint->state == EP_STATE_CLOSED && endpoint->failures >= globals->breaker_failures)) {
+            switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_WARNING, "Endpoint disabled for %d ms (failures=%d): %s\n", globals->breaker_open_ms, endpoint->failures, endpoint->url);
+            endpoint->state = EP_STATE_OPEN;
+            endpoint->open_until = switch_micro_time_now() + ((switch_time_t)globals->breaker_open_ms * 1000);
+        }
+    }
+    switch_mutex_unlock(globals->mutex);
+}
+
+uint32_t endpoint_hedge_delay(globals_t *globals) {
+    uint32_t window[LATENCY_WINDOW];
+    uint32_t count = 0, idx = 0;
+
+    if(!globals->hedge_percentile) {
+        return 0;
+    }
+
+    switch_mutex_lock(globals->mutex);
+    count = globals->latency_count;
+    memcpy(window, globals->latency_ms, count * sizeof(uint32_t));
+    switch_mutex_unlock(globals->mutex);
+
+    if(count < LATENCY_MIN_SAMPLES) {
+        return 0;
+    }
+
+    qsort(window, count, sizeof(uint32_t), latency_cmp);
+    idx = ((count * MIN(globals->hedge_percentile, 100)) + 99) / 100;
+    idx = (idx > 0 ? idx - 1 : 0);
+
+    return MAX(window[idx], globals->hedge_min_ms);
+}
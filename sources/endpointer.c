@@ -0,0 +1,126 @@
+/*
+ * FreeSWITCH Modular Media Switching Software Library / Soft-Switch Application
+ * Copyright (C) 2005-2014, Anthony Minessale II <anthm@freeswitch.org>
+ *
+ * Version: MPL 1.1
+ *
+ * The contents of this file are subject to the Mozilla Public License Version
+ * 1.1 (the "License"); you may not use this file except in compliance with
+ * the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS" basis,
+ * WITHOUT WARRANTY OF ANY KIND, either express or implied. See the License
+ * for the specific language governing rights and limitations under the
+ * License.
+ *
+ * Module Contributor(s):
+ *  Konstantin Alexandrin <akscfx@gmail.com>
+ *
+ *
+ * endpointer.c -- adaptive end of utterance
+ *
+ * Every leg learns the pauses its speaker resumes after (the hesitations) and the speech rate
+ * of its transcripts; the utterance is finalized once the silence outlasts most of those pauses,
+ * scaled by the rate and kept within 'endpoint-min-ms' .. 'endpoint-max-ms'.
+ * Pauses are measured on the fed audio, not the wall clock.
+ * The pause statistics are written by the feed thread and read by the worker, both under asr_ctx->mutex.
+ *
+ */
+#include "mod_openai_asr.h"
+#include <math.h>
+
+#define EP_ALPHA                0.2     // weight of the newest sample
+#define EP_MIN_SAMPLES          3
+#define EP_PAUSE_SIGMAS         2.0
+#define EP_REF_WORDS_PER_SEC    2.5
+#define EP_RATE_FACTOR_MIN      0.75
+#define EP_RATE_FACTOR_MAX      1.5
+
+static void ewma_update(double *mean, double *var, double x, uint32_t count) {
+    double diff = 0;
+
+    if(count == 0) {
+        *mean = x;
+        *var = 0;
+        return;
+    }
+    diff = x - *mean;
+    *mean += EP_ALPHA * diff;
+    *var = (1 - EP_ALPHA) * (*var + EP_ALPHA * diff * diff);
+}
+
+/* feed side, every frame */
+void endpointer_feed(asr_ctx_t *asr_ctx, asr_leg_t *leg, uint32_t data_len, switch_vad_state_t vad_state) {
+    endpointer_t *ep = &leg->ep;
+    uint32_t pause_ms = 0;
+
+    ep->clock_ms += (data_len * 1000) / (asr_ctx->samplerate * ASR_SAMPLE_BYTES(asr_ctx));
+
+    if(vad_state == SWITCH_VAD_STATE_STOP_TALKING) {
+        ep->stopped_ms = ep->clock_ms;
+    } else if(vad_state == SWITCH_VAD_STATE_START_TALKING && ep->stopped_ms) {
+        pause_ms = (ep->clock_ms - ep->stopped_ms);
+        ep->stopped_ms = 0;
+
+        /* longer ones ended the utterance anyway, they tell nothing about the hesitations */
+        if(pause_ms < asr_ctx->endpoint_max_ms) {
+            switch_mutex_lock(asr_ctx->mutex);
+            ewma_update(&ep->pause_mean, &ep->pause_var, pause_ms, ep->pauses_count);
+            ep->pauses_count++;
+            switch_mutex_unlock(asr_ctx->mutex);
+        }
+    }
+}
+
+/* worker side, a transcript of 'audio_ms' of audio has arrived */
+void endpointer_result(asr_ctx_t *asr_ctx, asr_leg_t *leg, const char *text, uint32_t audio_ms) {
+    endpointer_t *ep = &leg->ep;
+    uint32_t words = 0;
+    const char *p = NULL;
+    uint8_t fl_word = SWITCH_FALSE;
+
+    if(zstr(text) || audio_ms == 0) {
+        return;
+    }
+    for(p = text; *p; p++) {
+        if(switch_isspace(*p)) {
+            fl_word = SWITCH_FALSE;
+        } else if(!fl_word) {
+            fl_word = SWITCH_TRUE;
+            words++;
+        }
+    }
+    if(words > 0) {
+        double rate = (double)words * 1000 / audio_ms, var = 0;
+
+        ewma_update(&ep->words_per_sec, &var, rate, ep->results_count);
+        ep->results_count++;
+    }
+}
+
+/* worker side, ms of silence after which the utterance is over */
+uint32_t endpointer_deadline(asr_ctx_t *asr_ctx, asr_leg_t *leg, globals_t *globals) {
+    endpointer_t *ep = &leg->ep;
+    double deadline = (globals->sentence_threshold_sec * 1000), pause_mean = 0, pause_var = 0;
+    uint32_t pauses_count = 0;
+
+    if(!asr_ctx->fl_endpoint_adaptive) {
+        return (uint32_t)deadline;
+    }
+
+    switch_mutex_lock(asr_ctx->mutex);
+    pause_mean = ep->pause_mean;
+    pause_var = ep->pause_var;
+    pauses_count = ep->pauses_count;
+    switch_mutex_unlock(asr_ctx->mutex);
+
+    if(pauses_count >= EP_MIN_SAMPLES) {
+        deadline = pause_mean + EP_PAUSE_SIGMAS * sqrt(pause_var);
+        if(ep->results_count > 0 && ep->words_per_sec > 0) {
+            deadline *= MIN(MAX(EP_REF_WORDS_PER_SEC / ep->words_per_sec, EP_RATE_FACTOR_MIN), EP_RATE_FACTOR_MAX);
+        }
+    }
+
+    return (uint32_t)MIN(MAX(deadline, asr_ctx->endpoint_min_ms), asr_ctx->endpoint_max_ms);
+}
@@ -0,0 +1,169 @@
+/*
+ * FreeSWITCH Modular Media Switching Software Library / Soft-Switch Application
+ * Copyright (C) 2005-2014, Anthony Minessale II <anthm@freeswitch.org>
+ *
+ * Version: MPL 1.1
+ *
+ * The contents of this file are subject to the Mozilla Public License Version
+ * 1.1 (the "License"); you may not use this file except in compliance with
+ * the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS" basis,
+ * WITHOUT WARRANTY OF ANY KIND, either express or implied. See the License
+ * for the specific language governing rights and limitations under the
+ * License.
+ *
+ * Module Contributor(s):
+ *  Konstantin Alexandrin <akscfx@gmail.com>
+ *
+ *
+ * g711.c -- PCMU/PCMA expansion and wav container
+ *
+ * G.711 frames are kept as is all the way to the upload,
+ * only the VAD (and the backends that need linear pcm) get them expanded through the lookup tables.
+ *
+ */
+#include "mod_openai_asr.h"
+
+#define WAVE_FORMAT_ALAW    0x0006
+#define WAVE_FORMAT_MULAW   0x0007
+
+static int16_t ulaw_table[256];
+static int16_t alaw_table[256];
+
+static int16_t ulaw_expand(uint8_t v) {
+    int t = 0;
+
+    v = ~v;
+    t = (((v & 0x0f) << 3) + 0x84) << ((v & 0x70) >> 4);
+
+    return (int16_t)((v & 0x80) ? (0x84 - t) : (t - 0x84));
+}
+
+static int16_t alaw_expand(uint8_t v) {
+    int t = 0, seg = 0;
+
+    v ^= 0x55;
+    t = (v & 0x0f) << 4;
+    seg = (v & 0x70) >> 4;
+
+    switch(seg) {
+        case 0:
+            t += 8;
+            break;
+        case 1:
+            t += 0x108;
+            break;
+        default:
+            t += 0x108;
+            t <<= seg - 1;
+    }
+
+    return (int16_t)((v & 0x80) ? t : -t);
+}
+
+void g711_init(void) {
+    int i = 0;
+
+    for(i = 0; i < 256; i++) {
+        ulaw_table[i] = ulaw_expand((uint8_t)i);
+        alaw_table[i] = alaw_expand((uint8_t)i);
+    }
+}
+
+asr_codec_t g711_codec_lookup(const char *name) {
+    if(zstr(name)) {
+        return ASR_CODEC_NONE;
+    }
+    if(!strcasecmp(name, "L16")) {
+        return ASR_CODEC_L16;
+    }
+    if(!strcasecmp(name, "PCMU")) {
+        return ASR_CODEC_PCMU;
+    }
+    if(!strcasecmp(name, "PCMA")) {
+        return ASR_CODEC_PCMA;
+    }
+    return ASR_CODEC_NONE;
+}
+
+const char *g711_codec_name(asr_codec_t codec) {
+    switch(codec) {
+        case ASR_CODEC_L16:  return "L16";
+        case ASR_CODEC_PCMU: return "PCMU";
+        case ASR_CODEC_PCMA: return "PCMA";
+        default: break;
+    }
+    return NULL;
+}
+
+/* plain table lookups, the loop has no dependencies so the compiler is free to unroll/vectorize it */
+void g711_decode(asr_codec_t codec, const uint8_t *src, uint32_t samples, int16_t *dst) {
+    const int16_t *table = (codec == ASR_CODEC_PCMA ? alaw_table : ulaw_table);
+    uint32_t i = 0;
+
+    for(i = 0; i < samples; i++) {
+        dst[i] = table[src[i]];
+    }
+}
+
+static void wav_put16(uint8_t *p, uint16_t v) {
+    p[0] = (v & 0xff); p[1] = (v >> 8);
+}
+
+static void wav_put32(uint8_t *p, uint32_t v) {
+    p[0] = (v & 0xff); p[1] = ((v >> 8) & 0xff); p[2] = ((v >> 16) & 0xff); p[3] = (v >> 24);
+}
+
+/* RIFF/WAVE with the original 8-bit payload (format tag 6/7), half the size of the linear pcm */
+char *g711_chunk_write(asr_codec_t codec, switch_byte_t *buf, uint32_t buf_len, uint32_t channels, uint32_t samplerate, const char *path) {
+    uint8_t hdr[58] = { 0 };
+    char name_uuid[SWITCH_UUID_FORMATTED_LENGTH + 1] = { 0 };
+    char *file_name = NULL;
+    FILE *fp = NULL;
+
+    memcpy(hdr + 0, "RIFF", 4);
+    wav_put32(hdr + 4, (sizeof(hdr) - 8) + buf_len);
+    memcpy(hdr + 8, "WAVE", 4);
+
+    memcpy(hdr + 12, "fmt ", 4);
+    wav_put32(hdr + 16, 18);
+    wav_put16(hdr + 20, (codec == ASR_CODEC_PCMA ? WAVE_FORMAT_ALAW : WAVE_FORMAT_MULAW));
+    wav_put16(hdr + 22, channels);
+    wav_put32(hdr + 24, samplerate);
+    wav_put32(hdr + 28, samplerate * channels);
+    wav_put16(hdr + 32, channels);
+    wav_put16(hdr + 34, 8);
+    wav_put16(hdr + 36, 0);
+
+    memcpy(hdr + 38, "fact", 4);
+    wav_put32(hdr + 42, 4);
+    wav_put32(hdr + 46, buf_len / channels);
+
+    memcpy(hdr + 50, "data", 4);
+    wav_put32(hdr + 54, buf_len);
+
+    switch_uuid_str((char *)name_uuid, sizeof(name_uuid));
+    file_name = switch_mprintf("%s%s%s.wav", path, SWITCH_PATH_SEPARATOR, name_uuid);
+
+    if((fp = fopen(file_name, "wb")) == NULL) {
+        switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "Unable to open file (%s)\n", file_name);
+        goto fail;
+    }
+    if(fwrite(hdr, sizeof(hdr), 1, fp) != 1 || (buf_len && fwrite(buf, buf_len, 1, fp) != 1)) {
+        switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "Unable to write (%s)\n", file_name);
+        goto fail;
+    }
+    fclose(fp);
+
+    return file_name;
+
+fail:
+    if(fp) {
+        fclose(fp);
+        unlink(file_name);
+    }
+    switch_safe_free(file_name);
+    return NULL;
+}
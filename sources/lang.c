@@ -0,0 +1,131 @@
+/*
+ * FreeSWITCH Modular Media Switching Software Library / Soft-Switch Application
+ * Copyright (C) 2005-2014, Anthony Minessale II <anthm@freeswitch.org>
+ *
+ * Version: MPL 1.1
+ *
+ * The contents of this file are subject to the Mozilla Public License Version
+ * 1.1 (the "License"); you may not use this file except in compliance with
+ * the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS" basis,
+ * WITHOUT WARRANTY OF ANY KIND, either express or implied. See the License
+ * for the specific language governing rights and limitations under the
+ * License.
+ *
+ * Module Contributor(s):
+ *  Konstantin Alexandrin <akscfx@gmail.com>
+ *
+ *
+ * lang.c -- language detection and pinning
+ *
+ * The first utterances of a leg are requested with 'verbose_json' to learn the language,
+ * once the detection is confident enough the language is sent with every following request,
+ * this skips the language identification pass on the server and keeps results consistent.
+ *
+ */
+#include "mod_openai_asr.h"
+#include <math.h>
+
+typedef struct {
+    const char *name;
+    const char *code;
+} lang_map_t;
+
+/* verbose_json reports the language by name, the request expects ISO-639-1 */
+static const lang_map_t lang_map[] = {
+    { "english", "en" },    { "chinese", "zh" },    { "german", "de" },     { "spanish", "es" },
+    { "russian", "ru" },    { "korean", "ko" },     { "french", "fr" },     { "japanese", "ja" },
+    { "portuguese", "pt" }, { "turkish", "tr" },    { "polish", "pl" },     { "catalan", "ca" },
+    { "dutch", "nl" },      { "arabic", "ar" },     { "swedish", "sv" },    { "italian", "it" },
+    { "indonesian", "id" }, { "hindi", "hi" },      { "finnish", "fi" },    { "vietnamese", "vi" },
+    { "hebrew", "he" },     { "ukrainian", "uk" },  { "greek", "el" },      { "malay", "ms" },
+    { "czech", "cs" },      { "romanian", "ro" },   { "danish", "da" },     { "hungarian", "hu" },
+    { "tamil", "ta" },      { "norwegian", "no" },  { "thai", "th" },       { "urdu", "ur" },
+    { "croatian", "hr" },   { "bulgarian", "bg" },  { "lithuanian", "lt" }, { "latin", "la" },
+    { "welsh", "cy" },      { "slovak", "sk" },     { "telugu", "te" },     { "persian", "fa" },
+    { "latvian", "lv" },    { "bengali", "bn" },    { "serbian", "sr" },    { "azerbaijani", "az" },
+    { "slovenian", "sl" },  { "estonian", "et" },   { "macedonian", "mk" }, { "icelandic", "is" },
+    { "armenian", "hy" },   { "kazakh", "kk" },     { "belarusian", "be" }, { "georgian", "ka" },
+    { "tagalog", "tl" },    { "afrikaans", "af" },  { "swahili", "sw" },    { "uzbek", "uz" },
+    { NULL, NULL }
+};
+
+static const char *lang_code_lookup(const char *name) {
+    const lang_map_t *p = NULL;
+
+    if(zstr(name)) {
+        return NULL;
+    }
+    for(p = lang_map; p->name; p++) {
+        if(!strcasecmp(p->name, name) || !strcasecmp(p->code, name)) {
+            return p->code;
+        }
+    }
+
+    /* whisperd and the like report the code itself */
+    return (strlen(name) <= 3 ? name : NULL);
+}
+
+/*
+ * the service doesn't report the detection confidence directly,
+ * 'language_probability' is used when present (faster-whisper based servers),
+ * otherwise it's estimated from the segments average log probability.
+ */
+static double lang_detect_confidence(response_t *resp) {
+    if(resp->fl_language_probability) {
+        return resp->language_probability;
+    }
+    return (resp->segments ? exp(resp->logprob_sum / resp->segments) : 0);
+}
+
+const char *lang_request_language(asr_ctx_t *asr_ctx, asr_leg_t *leg, globals_t *globals) {
+    if(asr_ctx->opt_lang) {
+        return asr_ctx->opt_lang;
+    }
+    if(leg && leg->lang[0]) {
+        return leg->lang;
+    }
+    return globals->opt_lang;
+}
+
+switch_bool_t lang_detect_required(asr_ctx_t *asr_ctx, asr_leg_t *leg, globals_t *globals) {
+    if(!asr_ctx->fl_lang_detect || !leg) {
+        return SWITCH_FALSE;
+    }
+    if(lang_request_language(asr_ctx, leg, globals)) {
+        return SWITCH_FALSE;
+    }
+    return (leg->lang_detect_attempts < LANG_DETECT_ATTEMPTS);
+}
+
+void lang_detect_update(asr_ctx_t *asr_ctx, asr_leg_t *leg, response_t *resp, globals_t *globals) {
+    const char *code = NULL;
+    double confidence = 0;
+
+    if(!lang_detect_required(asr_ctx, leg, globals)) {
+        return;
+    }
+
+    leg->lang_detect_attempts++;
+
+    if(!resp->language[0]) {
+        return;
+    }
+    if((code = lang_code_lookup(resp->language)) == NULL) {
+        switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_WARNING, "Unknown language: %s\n", resp->language);
+        return;
+    }
+
+    confidence = lang_detect_confidence(resp);
+    if(confidence < globals->lang_detect_threshold) {
+        switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_DEBUG, "Language detection isn't confident (lang=%s, confidence=%.2f, attempt=%d)\n", code, confidence, leg->lang_detect_attempts);
+        return;
+    }
+
+    switch_copy_string(leg->lang, code, sizeof(leg->lang));
+
+    switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_DEBUG, "Language pinned (session=%s, leg=%s, lang=%s, confidence=%.2f)\n",
+                      (asr_ctx->session_uuid ? asr_ctx->session_uuid : "none"), leg->name, leg->lang, confidence);
+}
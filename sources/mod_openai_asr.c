@@ -119,36 +119,66 @@ out:
     return file_name;
 }
 
+/* the body is never stored, the fields are picked up as it arrives */
 static size_t curl_io_write_callback(char *buffer, size_t size, size_t nitems, void *user_data) {
-    switch_buffer_t *recv_buffer = (switch_buffer_t *)user_data;
+    response_t *response = (response_t *)user_data;
     size_t len = (size * nitems);
 
-    if(len > 0 && recv_buffer) {
-        switch_buffer_write(recv_buffer, buffer, len);
+    if(len > 0 && response) {
+        response_feed(response, buffer, len);
     }
 
     return len;
 }
 
-switch_status_t curl_perform(switch_buffer_t *recv_buffer, asr_ctx_t *asr_ctx, char *filename, globals_t *globals) {
+/* aborts the transfer as soon as the session is gone */
+static int curl_io_xferinfo_callback(void *user_data, curl_off_t dltotal, curl_off_t dlnow, curl_off_t ultotal, curl_off_t ulnow) {
+    asr_ctx_t *asr_ctx = (asr_ctx_t *)user_data;
+
+    return ((globals.fl_shutdown || asr_ctx->fl_destroyed) ? 1 : 0);
+}
+
+static size_t curl_io_header_callback(char *buffer, size_t size, size_t nitems, void *user_data) {
+    http_request_t *req = (http_request_t *)user_data;
+    size_t len = (size * nitems);
+
+    if(len > 0 && req) {
+        ratelimit_header_parse(&req->ratelimit, buffer, len);
+    }
+
+    return len;
+}
+
+static switch_status_t curl_request_init(http_request_t *req, response_t *response, asr_ctx_t *asr_ctx, asr_leg_t *leg, char *filename, endpoint_t *endpoint, api_key_t *api_key, globals_t *globals) {
     char *model_name = (char *)(asr_ctx->opt_model ? asr_ctx->opt_model : globals->opt_model);
-    
-    switch_status_t status = SWITCH_STATUS_SUCCESS;
+    const char *lang = lang_request_language(asr_ctx, leg, globals);
     CURL *curl_handle = NULL;
-    curl_mime *form = NULL;
-    curl_mimepart *field1=NULL, *field2=NULL, *field3=NULL, *field4=NULL, *field5=NULL;
-    switch_curl_slist_t *headers = NULL;
-    switch_CURLcode curl_ret = 0;
-    long http_resp = 0;
+    curl_mimepart *field1=NULL, *field2=NULL, *field3=NULL, *field4=NULL, *field5=NULL, *field6=NULL, *field7=NULL;
+
+    memset(req, 0, sizeof(http_request_t));
+
+    if((curl_handle = switch_curl_easy_init()) == NULL) {
+        return SWITCH_STATUS_FALSE;
+    }
 
-    curl_handle = switch_curl_easy_init();
-    headers = switch_curl_slist_append(headers, "Content-Type: multipart/form-data");
+    req->handle = curl_handle;
+    req->endpoint = endpoint;
+    req->api_key = api_key;
+    req->response = response;
+    ratelimit_info_init(&req->ratelimit);
+    req->headers = switch_curl_slist_append(req->headers, "Content-Type: multipart/form-data");
 
-    switch_curl_easy_setopt(curl_handle, CURLOPT_HTTPHEADER, headers);
+    switch_curl_easy_setopt(curl_handle, CURLOPT_PRIVATE, req);
+    switch_curl_easy_setopt(curl_handle, CURLOPT_HTTPHEADER, req->headers);
     switch_curl_easy_setopt(curl_handle, CURLOPT_POST, 1);
     switch_curl_easy_setopt(curl_handle, CURLOPT_NOSIGNAL, 1);
     switch_curl_easy_setopt(curl_handle, CURLOPT_WRITEFUNCTION, curl_io_write_callback);
-    switch_curl_easy_setopt(curl_handle, CURLOPT_WRITEDATA, (void *) recv_buffer);
+    switch_curl_easy_setopt(curl_handle, CURLOPT_WRITEDATA, (void *) response);
+    switch_curl_easy_setopt(curl_handle, CURLOPT_HEADERFUNCTION, curl_io_header_callback);
+    switch_curl_easy_setopt(curl_handle, CURLOPT_HEADERDATA, (void *) req);
+    switch_curl_easy_setopt(curl_handle, CURLOPT_NOPROGRESS, 0);
+    switch_curl_easy_setopt(curl_handle, CURLOPT_XFERINFOFUNCTION, curl_io_xferinfo_callback);
+    switch_curl_easy_setopt(curl_handle, CURLOPT_XFERINFODATA, (void *) asr_ctx);
 
     if(globals->connect_timeout > 0) {
         switch_curl_easy_setopt(curl_handle, CURLOPT_CONNECTTIMEOUT, globals->connect_timeout);
@@ -159,11 +189,13 @@ switch_status_t curl_perform(switch_buffer_t *recv_buffer, asr_ctx_t *asr_ctx, c
     if(globals->user_agent) {
         switch_curl_easy_setopt(curl_handle, CURLOPT_USERAGENT, globals->user_agent);
     }
-    if(strncasecmp(globals->api_url, "https", 5) == 0) {
+    if(endpoint->socket_path) {
+        switch_curl_easy_setopt(curl_handle, CURLOPT_UNIX_SOCKET_PATH, endpoint->socket_path);
+    } else if(strncasecmp(endpoint->url, "https", 5) == 0 && !globals->fl_tls_verify) {
         switch_curl_easy_setopt(curl_handle, CURLOPT_SSL_VERIFYPEER, 0);
         switch_curl_easy_setopt(curl_handle, CURLOPT_SSL_VERIFYHOST, 0);
     }
-    if(globals->proxy) {
+    if(globals->proxy && !endpoint->socket_path) {
         if(globals->proxy_credentials != NULL) {
             switch_curl_easy_setopt(curl_handle, CURLOPT_PROXYAUTH, CURLAUTH_ANY);
             switch_curl_easy_setopt(curl_handle, CURLOPT_PROXYUSERPWD, globals->proxy_credentials);
@@ -174,98 +206,655 @@ switch_status_t curl_perform(switch_buffer_t *recv_buffer, asr_ctx_t *asr_ctx, c
         switch_curl_easy_setopt(curl_handle, CURLOPT_PROXY, globals->proxy);
     }
 
-    curl_easy_setopt(curl_handle, CURLOPT_XOAUTH2_BEARER, globals->api_key);
+    curl_easy_setopt(curl_handle, CURLOPT_XOAUTH2_BEARER, api_key->key);
     curl_easy_setopt(curl_handle, CURLOPT_HTTPAUTH, CURLAUTH_BEARER);
 
-    if((form = curl_mime_init(curl_handle))) {
-        if((field1 = curl_mime_addpart(form))) {
+    if((req->form = curl_mime_init(curl_handle))) {
+        if((field1 = curl_mime_addpart(req->form))) {
             curl_mime_name(field1, "model");
             curl_mime_data(field1, model_name, CURL_ZERO_TERMINATED);
         }
-        if((field2 = curl_mime_addpart(form))) {
+        if((field2 = curl_mime_addpart(req->form))) {
             curl_mime_name(field2, "file");
             curl_mime_filedata(field2, filename);
         }
         if(asr_ctx->session_uuid != NULL){
-            if((field3 = curl_mime_addpart(form))) {
+            if((field3 = curl_mime_addpart(req->form))) {
                 curl_mime_name(field3, "session_uuid");
                 curl_mime_data(field3, asr_ctx->session_uuid, CURL_ZERO_TERMINATED);
             }
         }
         if(asr_ctx->caller_no != NULL){
-            if((field4 = curl_mime_addpart(form))) {
+            if((field4 = curl_mime_addpart(req->form))) {
                 curl_mime_name(field4, "caller_no");
                 curl_mime_data(field4, asr_ctx->caller_no, CURL_ZERO_TERMINATED);
             }
         }
         if(asr_ctx->dest_no != NULL){
-            if((field5 = curl_mime_addpart(form))) {
+            if((field5 = curl_mime_addpart(req->form))) {
                 curl_mime_name(field5, "dest_no");
                 curl_mime_data(field5, asr_ctx->dest_no, CURL_ZERO_TERMINATED);
             }
         }
-        switch_curl_easy_setopt(curl_handle, CURLOPT_MIMEPOST, form);
+        if(lang != NULL) {
+            if((field6 = curl_mime_addpart(req->form))) {
+                curl_mime_name(field6, "language");
+                curl_mime_data(field6, lang, CURL_ZERO_TERMINATED);
+            }
+        } else if(lang_detect_required(asr_ctx, leg, globals)) {
+            if((field7 = curl_mime_addpart(req->form))) {
+                curl_mime_name(field7, "response_format");
+                curl_mime_data(field7, "verbose_json", CURL_ZERO_TERMINATED);
+            }
+        }
+        switch_curl_easy_setopt(curl_handle, CURLOPT_MIMEPOST, req->form);
+    }
+
+    req->headers = switch_curl_slist_append(req->headers, "Expect:");
+    switch_curl_easy_setopt(curl_handle, CURLOPT_URL, endpoint->url);
+
+    return SWITCH_STATUS_SUCCESS;
+}
+
+static void curl_request_free(http_request_t *req) {
+    if(req->handle) {
+        switch_curl_easy_cleanup(req->handle);
+        req->handle = NULL;
+    }
+    if(req->form) {
+        curl_mime_free(req->form);
+        req->form = NULL;
     }
+    if(req->headers) {
+        switch_curl_slist_free_all(req->headers);
+        req->headers = NULL;
+    }
+}
 
-    headers = switch_curl_slist_append(headers, "Expect:");
-    switch_curl_easy_setopt(curl_handle, CURLOPT_URL, globals->api_url);
+static switch_bool_t curl_request_succeeded(http_request_t *req) {
+    return (req->fl_done && req->curl_ret == CURLE_OK && req->http_resp == 200);
+}
 
-    curl_ret = switch_curl_easy_perform(curl_handle);
-    if(!curl_ret) {
-        switch_curl_easy_getinfo(curl_handle, CURLINFO_RESPONSE_CODE, &http_resp);
-        if(!http_resp) { switch_curl_easy_getinfo(curl_handle, CURLINFO_HTTP_CONNECTCODE, &http_resp); }
+/* transport errors, 429 and 5xx are safe to repeat, the request doesn't change anything on the service side */
+static switch_bool_t curl_request_retryable(http_request_t *req) {
+    switch(req->curl_ret) {
+        case CURLE_OK:
+            return (req->http_resp >= 500 || req->http_resp == 429);
+        case CURLE_COULDNT_RESOLVE_HOST:
+        case CURLE_COULDNT_CONNECT:
+        case CURLE_OPERATION_TIMEDOUT:
+        case CURLE_SEND_ERROR:
+        case CURLE_RECV_ERROR:
+        case CURLE_GOT_NOTHING:
+            return SWITCH_TRUE;
+        default:
+            return SWITCH_FALSE;
+    }
+}
+
+static void curl_request_report(http_request_t *req, globals_t *globals) {
+    uint32_t latency_ms = (uint32_t)((switch_micro_time_now() - req->started) / 1000);
+
+    if(req->fl_done) {
+        apikey_update(globals, req->api_key, &req->ratelimit, req->http_resp);
+    }
+
+    /*
+     * the endpoint health isn't the same as the retryability: transport errors and 5xx count against the endpoint,
+     * only 2xx answers are healthy and timed, the rest (aborted, 429 and the other 4xx) says nothing about it
+     */
+    if(!req->fl_done || req->curl_ret == CURLE_ABORTED_BY_CALLBACK) {
+        endpoint_report(globals, req->endpoint, EP_RESULT_CANCELLED, 0);
+    } else if(req->curl_ret != CURLE_OK || req->http_resp >= 500) {
+        endpoint_report(globals, req->endpoint, EP_RESULT_FAILURE, 0);
+    } else if(req->http_resp >= 200 && req->http_resp < 300) {
+        endpoint_report(globals, req->endpoint, EP_RESULT_SUCCESS, latency_ms);
     } else {
-        http_resp = curl_ret;
+        endpoint_report(globals, req->endpoint, EP_RESULT_CANCELLED, 0);
+    }
+}
+
+/*
+ * performs a single attempt, when no answer arrives within the hedging delay
+ * a duplicate goes to another endpoint (or connection), the first successful answer wins
+ */
+static switch_status_t curl_perform_hedged(response_t *response, asr_ctx_t *asr_ctx, asr_leg_t *leg, char *filename, double audio_sec, api_key_t *api_key, globals_t *globals, long *http_resp, switch_bool_t *retryable) {
+    switch_status_t status = SWITCH_STATUS_FALSE;
+    http_request_t reqs[2] = { 0 };
+    http_request_t *winner = NULL;
+    response_t *hedge_response = &LEG_RESPONSES(asr_ctx, leg)[1];
+    endpoint_t *endpoint = NULL;
+    api_key_t *hedge_key = NULL;
+    CURLM *curl_multi = LEG_CURL_MULTI(asr_ctx, leg);
+    CURLMsg *msg = NULL;
+    uint32_t hedge_delay_ms = 0, nreqs = 0, i = 0;
+    int running = 0, msgs_left = 0;
+
+    *http_resp = 0;
+    *retryable = SWITCH_TRUE;
+
+    if(!curl_multi && (curl_multi = curl_multi_init()) == NULL) {
+        switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "curl_multi_init()\n");
+        return SWITCH_STATUS_FALSE;
     }
 
-    if(http_resp != 200) {
-        switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "http-error=[%ld] (%s)\n", http_resp, globals->api_url);
-        status = SWITCH_STATUS_FALSE;
+    if((endpoint = endpoint_acquire(globals, NULL)) == NULL) {
+        switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "No available endpoints\n");
+        goto out;
+    }
+    if(curl_request_init(&reqs[0], response, asr_ctx, leg, filename, endpoint, api_key, globals) != SWITCH_STATUS_SUCCESS) {
+        endpoint_report(globals, endpoint, EP_RESULT_CANCELLED, 0);
+        goto out;
+    }
+    reqs[0].started = switch_micro_time_now();
+    curl_multi_add_handle(curl_multi, reqs[0].handle);
+    nreqs = 1;
+
+    hedge_delay_ms = endpoint_hedge_delay(globals);
+
+    while(!winner) {
+        if(globals->fl_shutdown || asr_ctx->fl_destroyed || speculation_stale(asr_ctx, leg)) {
+            *retryable = SWITCH_FALSE;
+            goto out;
+        }
+
+        curl_multi_perform(curl_multi, &running);
+
+        while((msg = curl_multi_info_read(curl_multi, &msgs_left))) {
+            http_request_t *req = NULL;
+
+            if(msg->msg != CURLMSG_DONE) {
+                continue;
+            }
+            switch_curl_easy_getinfo(msg->easy_handle, CURLINFO_PRIVATE, (char **)&req);
+            if(!req) {
+                continue;
+            }
+            req->fl_done = SWITCH_TRUE;
+            req->curl_ret = msg->data.result;
+            if(req->curl_ret == CURLE_OK) {
+                switch_curl_easy_getinfo(req->handle, CURLINFO_RESPONSE_CODE, &req->http_resp);
+                if(!req->http_resp) { switch_curl_easy_getinfo(req->handle, CURLINFO_HTTP_CONNECTCODE, &req->http_resp); }
+            } else {
+                req->http_resp = req->curl_ret;
+            }
+            if(curl_request_succeeded(req)) {
+                winner = req;
+                break;
+            }
+        }
+        if(winner) {
+            break;
+        }
+
+        /* nothing succeeded, the primary request tells the result */
+        if(reqs[0].fl_done && (nreqs == 1 || reqs[1].fl_done)) {
+            winner = &reqs[0];
+            break;
+        }
+
+        if(nreqs == 1 && hedge_delay_ms && !reqs[0].fl_done && ((switch_micro_time_now() - reqs[0].started) / 1000) >= hedge_delay_ms) {
+            /*
+             * the hedge must fit into the rate limits as well, it's never worth waiting for;
+             * the endpoint goes first, a key token taken for a hedge that has nowhere to go would be wasted,
+             * a hedge that couldn't be sent is tried again on the next round
+             */
+            if((endpoint = endpoint_acquire(globals, reqs[0].endpoint)) != NULL) {
+                if((hedge_key = apikey_acquire(globals, audio_sec, NULL)) == NULL) {
+                    endpoint_report(globals, endpoint, EP_RESULT_CANCELLED, 0);
+                } else {
+                    response_reset(hedge_response);
+                    if(curl_request_init(&reqs[1], hedge_response, asr_ctx, leg, filename, endpoint, hedge_key, globals) == SWITCH_STATUS_SUCCESS) {
+                        if(endpoint == reqs[0].endpoint) {
+                            switch_curl_easy_setopt(reqs[1].handle, CURLOPT_FRESH_CONNECT, 1);
+                        }
+                        reqs[1].started = switch_micro_time_now();
+                        curl_multi_add_handle(curl_multi, reqs[1].handle);
+                        nreqs = 2;
+                        switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_DEBUG, "Hedging request after %d ms (%s)\n", hedge_delay_ms, endpoint->url);
+                    } else {
+                        endpoint_report(globals, endpoint, EP_RESULT_CANCELLED, 0);
+                    }
+                }
+            }
+        }
+
+        /* asr_ctx_destroy() interrupts it with curl_multi_wakeup() */
+        curl_multi_poll(curl_multi, NULL, 0, 10, NULL);
+    }
+
+    /* both stay with the session, only the roles change */
+    if(winner == &reqs[1]) {
+        response_t tmp = *response;
+
+        *response = *hedge_response;
+        *hedge_response = tmp;
+    }
+
+    *http_resp = winner->http_resp;
+    if(curl_request_succeeded(winner)) {
+        *retryable = SWITCH_FALSE;
+        status = SWITCH_STATUS_SUCCESS;
+    } else {
+        *retryable = curl_request_retryable(winner);
+        switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "http-error=[%ld] (%s)\n", winner->http_resp, winner->endpoint->url);
     }
 
-    if(recv_buffer) {
-        if(switch_buffer_inuse(recv_buffer) > 0) {
-            switch_buffer_write(recv_buffer, "\0", 1);
+out:
+    for(i = 0; i < nreqs; i++) {
+        if(reqs[i].handle) {
+            curl_multi_remove_handle(curl_multi, reqs[i].handle);
+            curl_request_report(&reqs[i], globals);
         }
+        curl_request_free(&reqs[i]);
     }
+    if(curl_multi != LEG_CURL_MULTI(asr_ctx, leg)) {
+        curl_multi_cleanup(curl_multi);
+    }
+
+    return status;
+}
+
+static switch_bool_t curl_wait(asr_ctx_t *asr_ctx, asr_leg_t *leg, globals_t *globals, uint32_t delay_ms) {
+    switch_time_t now = switch_micro_time_now(), until = now + ((switch_time_t)delay_ms * 1000);
+    switch_bool_t result = SWITCH_TRUE;
 
-    if(curl_handle) {
-        switch_curl_easy_cleanup(curl_handle);
+    switch_mutex_lock(asr_ctx->mutex);
+    while(!(globals->fl_shutdown || asr_ctx->fl_destroyed || speculation_stale(asr_ctx, leg)) && (now = switch_micro_time_now()) < until) {
+        switch_thread_cond_timedwait(asr_ctx->cond, asr_ctx->mutex, MIN(until - now, 100000));
     }
-    if(form) {
-        curl_mime_free(form);
+    result = !(globals->fl_shutdown || asr_ctx->fl_destroyed || speculation_stale(asr_ctx, leg));
+    switch_mutex_unlock(asr_ctx->mutex);
+
+    return result;
+}
+
+switch_status_t curl_perform(response_t *response, asr_ctx_t *asr_ctx, asr_leg_t *leg, char *filename, double audio_sec, globals_t *globals) {
+    switch_status_t status = SWITCH_STATUS_FALSE;
+    switch_time_t deadline = switch_micro_time_now() + ((switch_time_t)globals->ratelimit_max_wait * 1000000);
+    switch_time_t wait = 0;
+    switch_bool_t retryable = SWITCH_FALSE;
+    api_key_t *api_key = NULL;
+    unsigned int seed = (unsigned int)switch_micro_time_now();
+    uint32_t attempt = 0, delay_ms = 0;
+    long http_resp = 0;
+
+    if(!globals->api_keys_count) {
+        switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "Missing required parameter: api-key\n");
+        goto out;
     }
-    if(headers) {
-        switch_curl_slist_free_all(headers);
+
+    while(attempt <= globals->retry_attempts) {
+        /* pacing: hold the request until some key fits into its limits */
+        while((api_key = apikey_acquire(globals, audio_sec, &wait)) == NULL) {
+            if(switch_micro_time_now() + wait > deadline) {
+                switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "Rate limits don't allow the request within %d sec\n", globals->ratelimit_max_wait);
+                goto out;
+            }
+            if(!curl_wait(asr_ctx, leg, globals, MAX(wait / 1000, 1))) {
+                goto out;
+            }
+        }
+
+        response_reset(response);
+
+        if((status = curl_perform_hedged(response, asr_ctx, leg, filename, audio_sec, api_key, globals, &http_resp, &retryable)) == SWITCH_STATUS_SUCCESS || !retryable) {
+            break;
+        }
+
+        /* 429: the key is paused now, another one (or the same after the pause) takes the retry */
+        if(http_resp == 429) {
+            continue;
+        }
+
+        if(++attempt > globals->retry_attempts) {
+            break;
+        }
+
+        /* full jitter: somewhere between 0 and the exponential backoff */
+        delay_ms = globals->retry_delay_ms << MIN(attempt - 1, 8);
+        delay_ms = (delay_ms ? (rand_r(&seed) % delay_ms) + 1 : 0);
+
+        switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_DEBUG, "Retrying request in %d ms (attempt=%d)\n", delay_ms, attempt);
+        if(!curl_wait(asr_ctx, leg, globals, delay_ms)) {
+            goto out;
+        }
     }
 
+out:
     return status;
 }
 
+/* 'owned' - the text is malloc()ed and taken over, it reaches asr_get_results() as is */
+static void asr_result_deliver(asr_ctx_t *asr_ctx, asr_leg_t *leg, char *text, switch_bool_t owned) {
+    endpointer_result(asr_ctx, leg, text, leg->ep.utterance_ms);
+
+    if(asr_ctx->bug) {
+        switch_event_t *event = NULL;
+
+        if(switch_event_create_subclass(&event, SWITCH_EVENT_CUSTOM, RESULT_EVENT) == SWITCH_STATUS_SUCCESS) {
+            if(asr_ctx->session_uuid) {
+                switch_event_add_header_string(event, SWITCH_STACK_BOTTOM, "Unique-ID", asr_ctx->session_uuid);
+            }
+            switch_event_add_header_string(event, SWITCH_STACK_BOTTOM, "Speaker-Leg", leg->name);
+            switch_event_add_body(event, "%s", text);
+            switch_event_fire(&event);
+        }
+        goto out;
+    }
+
+    if(!zstr(text) && (owned || (text = strdup(text)) != NULL)) {
+        if(switch_queue_trypush(asr_ctx->q_text, text) == SWITCH_STATUS_SUCCESS) {
+            switch_mutex_lock(asr_ctx->mutex);
+            asr_ctx->transcription_results++;
+            switch_mutex_unlock(asr_ctx->mutex);
+            return;
+        }
+        owned = SWITCH_TRUE;
+    }
+
+out:
+    if(owned) {
+        switch_safe_free(text);
+    }
+}
+
+/*
+ * the results are malloc()ed because the core free()s what asr_get_results() returns,
+ * a borrowed text is copied once, a taken one (response_detach_text) isn't copied at all
+ */
+void asr_result_push(asr_ctx_t *asr_ctx, asr_leg_t *leg, const char *text) {
+    if(leg->fl_speculating) {
+        switch_safe_free(leg->spec_text);
+        leg->spec_text = strdup(text);
+        return;
+    }
+    asr_result_deliver(asr_ctx, leg, (char *)text, SWITCH_FALSE);
+}
+
+void asr_result_take(asr_ctx_t *asr_ctx, asr_leg_t *leg, char *text) {
+    if(leg->fl_speculating) {
+        switch_safe_free(leg->spec_text);
+        leg->spec_text = text;
+        return;
+    }
+    asr_result_deliver(asr_ctx, leg, text, SWITCH_TRUE);
+}
+
+/* the events copy the text anyway, there the buffer stays with the response for the next one */
+void asr_result_push_response(asr_ctx_t *asr_ctx, asr_leg_t *leg, response_t *response) {
+    if(asr_ctx->bug && !leg->fl_speculating) {
+        asr_result_push(asr_ctx, leg, (response->text ? response->text : ""));
+        return;
+    }
+    asr_result_take(asr_ctx, leg, response_detach_text(response));
+}
+
+static void asr_results_clean(asr_ctx_t *asr_ctx) {
+    void *pop = NULL;
+
+    while(switch_queue_trypop(asr_ctx->q_text, &pop) == SWITCH_STATUS_SUCCESS) {
+        switch_safe_free(pop);
+    }
+}
+
+/* streaming backends only, the event is fired regardless of the mode and nothing goes to q_text */
+void asr_partial_push(asr_ctx_t *asr_ctx, asr_leg_t *leg, const char *text) {
+    switch_event_t *event = NULL;
+
+    if(!asr_ctx->session_uuid) {
+        return;
+    }
+    if(switch_event_create_subclass(&event, SWITCH_EVENT_CUSTOM, RESULT_EVENT) == SWITCH_STATUS_SUCCESS) {
+        switch_event_add_header_string(event, SWITCH_STACK_BOTTOM, "Unique-ID", asr_ctx->session_uuid);
+        switch_event_add_header_string(event, SWITCH_STACK_BOTTOM, "Speaker-Leg", leg->name);
+        switch_event_add_header_string(event, SWITCH_STACK_BOTTOM, "Result-Type", "partial");
+        switch_event_add_body(event, "%s", text);
+        switch_event_fire(&event);
+    }
+}
+
+static switch_status_t http_transcribe(asr_ctx_t *asr_ctx, asr_leg_t *leg, switch_byte_t *data, uint32_t data_len, globals_t *globals) {
+    switch_status_t status = SWITCH_STATUS_FALSE;
+    response_t *response = &LEG_RESPONSES(asr_ctx, leg)[0];
+    char *chunk_fname = NULL;
+
+    if(asr_ctx->codec == ASR_CODEC_L16) {
+        chunk_fname = chunk_write(data, data_len, asr_ctx->channels, asr_ctx->samplerate, globals->opt_encoding);
+    } else if(globals->fl_g711_upload) {
+        chunk_fname = g711_chunk_write(asr_ctx->codec, data, data_len, asr_ctx->channels, asr_ctx->samplerate, globals->tmp_path);
+    } else {
+        int16_t *pcm = NULL;
+
+        switch_malloc(pcm, data_len * sizeof(int16_t));
+        g711_decode(asr_ctx->codec, data, data_len, pcm);
+        chunk_fname = chunk_write((switch_byte_t *)pcm, data_len * sizeof(int16_t), asr_ctx->channels, asr_ctx->samplerate, globals->opt_encoding);
+        switch_safe_free(pcm);
+    }
+    if(chunk_fname == NULL) {
+        goto out;
+    }
+
+    status = curl_perform(response, asr_ctx, leg, chunk_fname, ((double)data_len / (asr_ctx->samplerate * ASR_SAMPLE_BYTES(asr_ctx))), globals);
+    if(status == SWITCH_STATUS_SUCCESS) {
+        status = SWITCH_STATUS_FALSE;
+        if(response->head_len == 0) {
+            switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "Service response is empty!\n");
+        } else if(!response_complete(response)) {
+            switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "Unable to parse json (%s)\n", response->head);
+        } else if(response->fl_error) {
+            switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "Service response: %s\n", (response->error[0] ? response->error : response->head));
+        } else if(!response->fl_text) {
+            switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "Malformed response: (%s)\n", response->head);
+        } else {
+            asr_result_push_response(asr_ctx, leg, response);
+            lang_detect_update(asr_ctx, leg, response, globals);
+            status = SWITCH_STATUS_SUCCESS;
+        }
+    } else {
+        if(globals->fl_log_http_errors && response->head_len) {
+            switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "Service response: (%s)\n", response->head);
+        } else {
+            switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "Unable to perform request (status=%d)\n", (int)status);
+        }
+    }
+
+out:
+    if(chunk_fname) {
+        unlink(chunk_fname);
+        switch_safe_free(chunk_fname);
+    }
+    return status;
+}
+
+/* called with asr_ctx->mutex locked, or with NULL on shutdown */
+static void http_wakeup(asr_ctx_t *asr_ctx) {
+    uint32_t i = 0;
+
+    if(!asr_ctx) {
+        return;
+    }
+    if(asr_ctx->curl_multi) {
+        curl_multi_wakeup(asr_ctx->curl_multi);
+    }
+    for(i = 0; i < asr_ctx->legs_count; i++) {
+        if(asr_ctx->legs[i].spec_multi) {
+            curl_multi_wakeup(asr_ctx->legs[i].spec_multi);
+        }
+    }
+}
+
+asr_backend_t backend_http = {
+    "http",
+    NULL,
+    NULL,
+    http_transcribe,
+    http_wakeup,
+    NULL,
+    NULL,
+    NULL
+};
+
+static asr_backend_t *backends[] = {
+    &backend_http,
+    &backend_whisper,
+    &backend_realtime,
+    &backend_local,
+    &backend_mock,
+    NULL
+};
+
+static asr_backend_t *backend_lookup(const char *name) {
+    asr_backend_t **p = NULL;
+
+    if(zstr(name)) {
+        return NULL;
+    }
+    for(p = backends; *p; p++) {
+        if(!strcasecmp((*p)->name, name)) {
+            return *p;
+        }
+    }
+    return NULL;
+}
+
+typedef struct {
+    asr_ctx_t               *asr_ctx;
+    asr_leg_t               *leg;
+} speculation_t;
+
+/*
+ * one per leg, takes the utterance handed over at STOP_TALKING and leaves the result in spec_text,
+ * the worker goes on with the other leg meanwhile and merges the result at the deadline
+ */
+static void *SWITCH_THREAD_FUNC speculation_thread(switch_thread_t *thread, void *obj) {
+    speculation_t *spec = (speculation_t *)obj;
+    asr_ctx_t *asr_ctx = spec->asr_ctx;
+    asr_leg_t *leg = spec->leg;
+    switch_status_t status = SWITCH_STATUS_FALSE;
+
+    while(SWITCH_TRUE) {
+        switch_mutex_lock(asr_ctx->mutex);
+        while(!leg->fl_spec_running && !globals.fl_shutdown && !asr_ctx->fl_destroyed) {
+            switch_thread_cond_timedwait(asr_ctx->cond, asr_ctx->mutex, 100000);
+        }
+        if(!leg->fl_spec_running) {
+            switch_mutex_unlock(asr_ctx->mutex);
+            break;
+        }
+        switch_mutex_unlock(asr_ctx->mutex);
+
+        status = asr_ctx->backend->transcribe(asr_ctx, leg, leg->spec_data, leg->spec_data_len, &globals);
+
+        switch_mutex_lock(asr_ctx->mutex);
+        if(status == SWITCH_STATUS_SUCCESS && !speculation_stale(asr_ctx, leg)) {
+            leg->spec_len = leg->spec_data_len;
+        } else {
+            switch_safe_free(leg->spec_text);
+        }
+        leg->fl_speculating = SWITCH_FALSE;
+        leg->fl_spec_running = SWITCH_FALSE;
+        switch_thread_cond_broadcast(asr_ctx->cond);
+        switch_mutex_unlock(asr_ctx->mutex);
+    }
+
+    return NULL;
+}
+
+/* the speaker went on while the speculative request was in flight */
+switch_bool_t speculation_stale(asr_ctx_t *asr_ctx, asr_leg_t *leg) {
+    switch_bool_t stale = SWITCH_FALSE;
+
+    switch_mutex_lock(asr_ctx->mutex);
+    stale = (leg->fl_speculating && leg->vad_state != SWITCH_VAD_STATE_STOP_TALKING);
+    switch_mutex_unlock(asr_ctx->mutex);
+
+    return stale;
+}
+
+static switch_bool_t speculation_running(asr_ctx_t *asr_ctx, asr_leg_t *leg) {
+    switch_bool_t running = SWITCH_FALSE;
+
+    switch_mutex_lock(asr_ctx->mutex);
+    running = leg->fl_spec_running;
+    switch_mutex_unlock(asr_ctx->mutex);
+
+    return running;
+}
+
+/* sends the utterance right at STOP_TALKING without waiting for it, gives up as soon as the speaker goes on */
+static void speculation_start(asr_ctx_t *asr_ctx, asr_leg_t *leg, switch_memory_pool_t *pool) {
+    switch_threadattr_t *attr = NULL;
+    speculation_t *spec = NULL;
+    const void *chunk_buffer_ptr = NULL;
+    CURLM *curl_multi = NULL;
+    uint32_t buf_len = 0;
+
+    /* the previous one is still being cancelled, this utterance goes as a whole */
+    if(speculation_running(asr_ctx, leg)) {
+        return;
+    }
+
+    switch_safe_free(leg->spec_text);
+    leg->spec_len = 0;
+
+    if((buf_len = switch_buffer_peek_zerocopy(leg->chunk_buffer, &chunk_buffer_ptr)) == 0 || !chunk_buffer_ptr) {
+        return;
+    }
+
+    if(!leg->spec_thread) {
+        spec = switch_core_alloc(pool, sizeof(speculation_t));
+        spec->asr_ctx = asr_ctx;
+        spec->leg = leg;
+
+        switch_threadattr_create(&attr, pool);
+        switch_threadattr_stacksize_set(attr, SWITCH_THREAD_STACKSIZE);
+        if(switch_thread_create(&leg->spec_thread, attr, speculation_thread, spec, pool) != SWITCH_STATUS_SUCCESS) {
+            switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "switch_thread_create()\n");
+            leg->spec_thread = NULL;
+            return;
+        }
+    }
+    if(!leg->spec_multi && (curl_multi = curl_multi_init()) != NULL) {
+        switch_mutex_lock(asr_ctx->mutex);
+        leg->spec_multi = curl_multi;
+        switch_mutex_unlock(asr_ctx->mutex);
+    }
+
+    if(leg->spec_data_size < buf_len) {
+        switch_safe_free(leg->spec_data);
+        switch_malloc(leg->spec_data, buf_len);
+        leg->spec_data_size = buf_len;
+    }
+    memcpy(leg->spec_data, chunk_buffer_ptr, buf_len);
+    leg->spec_data_len = buf_len;
+
+    leg->ep.utterance_ms = ((uint64_t)buf_len * 1000) / (asr_ctx->samplerate * ASR_SAMPLE_BYTES(asr_ctx));
+    asr_ctx->requests++;
+
+    switch_mutex_lock(asr_ctx->mutex);
+    leg->fl_speculating = SWITCH_TRUE;
+    leg->fl_spec_running = SWITCH_TRUE;
+    switch_thread_cond_broadcast(asr_ctx->cond);
+    switch_mutex_unlock(asr_ctx->mutex);
+}
+
 static void *SWITCH_THREAD_FUNC transcribe_thread(switch_thread_t *thread, void *obj) {
     volatile asr_ctx_t *_ref = (asr_ctx_t *)obj;
     asr_ctx_t *asr_ctx = (asr_ctx_t *)_ref;
-    switch_status_t status;
-    switch_buffer_t *chunk_buffer = NULL;
-    switch_buffer_t *curl_recv_buffer = NULL;
     switch_memory_pool_t *pool = NULL;
-    cJSON *json = NULL;
-    time_t sentence_timeout = 0;
-    uint32_t schunks = 0;
     uint32_t chunk_buffer_size = 0;
+    uint32_t i = 0;
     uint8_t fl_cbuff_overflow = SWITCH_FALSE;
+    switch_vad_state_t vad_state = SWITCH_VAD_STATE_NONE;
     void *pop = NULL;
 
-    switch_mutex_lock(asr_ctx->mutex);
-    asr_ctx->refs++;
-    switch_mutex_unlock(asr_ctx->mutex);
-
     if(switch_core_new_memory_pool(&pool) != SWITCH_STATUS_SUCCESS) {
         switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_CRIT, "switch_core_new_memory_pool()\n");
         goto out;
     }
-    if(switch_buffer_create_dynamic(&curl_recv_buffer, 1024, 2048, 4096) != SWITCH_STATUS_SUCCESS) {
-        switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "switch_buffer_create_dynamic()\n");
+    if((asr_ctx->curl_multi = curl_multi_init()) == NULL) {
+        switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "curl_multi_init()\n");
         goto out;
     }
 
@@ -279,113 +868,146 @@ static void *SWITCH_THREAD_FUNC transcribe_thread(switch_thread_t *thread, void
             switch_mutex_unlock(asr_ctx->mutex);
 
             if(chunk_buffer_size > 0) {
-                if(switch_buffer_create(pool, &chunk_buffer, chunk_buffer_size) != SWITCH_STATUS_SUCCESS) {
-                    switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_CRIT, "switch_buffer_create()\n");
-                    break;
+                for(i = 0; i < asr_ctx->legs_count; i++) {
+                    if(switch_buffer_create(pool, &asr_ctx->legs[i].chunk_buffer, chunk_buffer_size) != SWITCH_STATUS_SUCCESS) {
+                        switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_CRIT, "switch_buffer_create()\n");
+                        goto out;
+                    }
+                    switch_buffer_zero(asr_ctx->legs[i].chunk_buffer);
                 }
-                switch_buffer_zero(chunk_buffer);
             }
             goto timer_next;
         }
 
-        fl_cbuff_overflow = SWITCH_FALSE;
-        while(switch_queue_trypop(asr_ctx->q_audio, &pop) == SWITCH_STATUS_SUCCESS) {
-            xdata_buffer_t *audio_buffer = (xdata_buffer_t *)pop;
-            if(globals.fl_shutdown || asr_ctx->fl_destroyed ) {
+        for(i = 0; i < asr_ctx->legs_count; i++) {
+            asr_leg_t *leg = &asr_ctx->legs[i];
+
+            fl_cbuff_overflow = SWITCH_FALSE;
+            while(switch_queue_trypop(leg->q_audio, &pop) == SWITCH_STATUS_SUCCESS) {
+                xdata_buffer_t *audio_buffer = (xdata_buffer_t *)pop;
+                if(globals.fl_shutdown || asr_ctx->fl_destroyed ) {
+                    xdata_buffer_free(&audio_buffer);
+                    break;
+                }
+                if(audio_buffer && audio_buffer->len) {
+                    if(asr_ctx->backend->stream) {
+                        asr_ctx->backend->stream(asr_ctx, leg, audio_buffer->data, audio_buffer->len, &globals);
+                        leg->streamed += audio_buffer->len;
+                        fl_cbuff_overflow = (leg->streamed >= chunk_buffer_size);
+                    } else if(switch_buffer_write(leg->chunk_buffer, audio_buffer->data, audio_buffer->len) >= chunk_buffer_size) {
+                        fl_cbuff_overflow = SWITCH_TRUE;
+                    }
+                    leg->schunks++;
+                }
                 xdata_buffer_free(&audio_buffer);
-                break;
-            }
-            if(audio_buffer && audio_buffer->len) {
-                if(switch_buffer_write(chunk_buffer, audio_buffer->data, audio_buffer->len) >= chunk_buffer_size) {
-                    fl_cbuff_overflow = SWITCH_TRUE;
+                if(fl_cbuff_overflow) {
                     break;
                 }
-                schunks++;
             }
-            xdata_buffer_free(&audio_buffer);
-        }
 
-        if(fl_cbuff_overflow) {
-            sentence_timeout = 1;
-        }
-        if(schunks && asr_ctx->vad_state == SWITCH_VAD_STATE_STOP_TALKING) {
-            if(!sentence_timeout) {
-                sentence_timeout = globals.sentence_threshold_sec + switch_epoch_time_now(NULL);
+            if(fl_cbuff_overflow) {
+                leg->sentence_timeout = 1;
             }
-        }
-
-        if(sentence_timeout && sentence_timeout <= switch_epoch_time_now(NULL)) {
-            const void *chunk_buffer_ptr = NULL;
-            const void *http_response_ptr = NULL;
-            uint32_t buf_len = 0, http_recv_len = 0;
-            char *chunk_fname = NULL;
+            switch_mutex_lock(asr_ctx->mutex);
+            vad_state = leg->vad_state;
+            switch_mutex_unlock(asr_ctx->mutex);
 
-            if((buf_len = switch_buffer_peek_zerocopy(chunk_buffer, &chunk_buffer_ptr)) > 0 && chunk_buffer_ptr) {
-                chunk_fname = chunk_write((switch_byte_t *)chunk_buffer_ptr, buf_len, asr_ctx->channels, asr_ctx->samplerate, globals.opt_encoding);
-            }
-            if(chunk_fname) {
-                switch_buffer_zero(curl_recv_buffer);
-                
-                status = curl_perform(curl_recv_buffer, asr_ctx, chunk_fname, &globals);
-                http_recv_len = switch_buffer_peek_zerocopy(curl_recv_buffer, &http_response_ptr);
-                if(status == SWITCH_STATUS_SUCCESS) {
-                    if(http_response_ptr && http_recv_len) {
-                        if((json = cJSON_Parse((char *)http_response_ptr))) {
-                            cJSON *jres = cJSON_GetObjectItem(json, "error");
-                            if(jres) {
-                                switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "Service response: %s\n", (char *)http_response_ptr);
-                            } else {
-                                cJSON *jres = cJSON_GetObjectItem(json, "text");
-                                if(jres) {
-                                    xdata_buffer_t *tbuff = NULL;
-                                    if(xdata_buffer_alloc(&tbuff, (switch_byte_t *)jres->valuestring, strlen(jres->valuestring)) == SWITCH_STATUS_SUCCESS) {
-                                        if(switch_queue_trypush(asr_ctx->q_text, tbuff) == SWITCH_STATUS_SUCCESS) {
-                                            switch_mutex_lock(asr_ctx->mutex);
-                                            asr_ctx->transcription_results++;
-                                            switch_mutex_unlock(asr_ctx->mutex);
-                                        } else {
-                                            xdata_buffer_free(&tbuff);
-                                        }
-                                    }
-                                } else {
-                                    switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "Malformed response: (%s)\n", (char *)http_response_ptr);
-                                }
-                            }
-                        } else {
-                            switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "Unable to parse json (%s)\n", (char *)http_response_ptr);
-                        }
-                    } else {
-                        switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "Service response is empty!\n");
+            if(leg->schunks && vad_state == SWITCH_VAD_STATE_STOP_TALKING) {
+                if(!leg->sentence_timeout) {
+                    leg->sentence_timeout = switch_micro_time_now() + (endpointer_deadline(asr_ctx, leg, &globals) * 1000);
+                    if(asr_ctx->fl_speculative && !asr_ctx->backend->stream) {
+                        speculation_start(asr_ctx, leg, pool);
                     }
-                } else {
-                    if(globals.fl_log_http_errors && http_recv_len) {
-                        switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "Service response: (%s)\n", (char *)http_response_ptr);
-                    } else {
-                        switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "Unable to perform request (status=%d)\n", (int)status);
+                }
+            } else if(leg->sentence_timeout && !fl_cbuff_overflow && asr_ctx->fl_endpoint_adaptive) {
+                /* resumed in time, the pause was a hesitation and the utterance goes on */
+                leg->sentence_timeout = 0;
+            }
+
+            /* a speculation in flight is merged once it's over: answered or cancelled by the speaker going on */
+            if(leg->sentence_timeout && leg->sentence_timeout <= switch_micro_time_now() && !speculation_running(asr_ctx, leg)) {
+                const void *chunk_buffer_ptr = NULL;
+                uint32_t buf_len = 0;
+
+                if(asr_ctx->backend->stream) {
+                    leg->ep.utterance_ms = (leg->streamed * 1000) / (asr_ctx->samplerate * ASR_SAMPLE_BYTES(asr_ctx));
+                    asr_ctx->backend->stream(asr_ctx, leg, NULL, 0, &globals);
+                    asr_ctx->requests++;
+                    leg->streamed = 0;
+                } else if(leg->spec_len && leg->spec_len == switch_buffer_inuse(leg->chunk_buffer)) {
+                    /* nothing was said since the speculative upload, its result is the answer */
+                    if(leg->spec_text) {
+                        asr_result_deliver(asr_ctx, leg, leg->spec_text, SWITCH_TRUE);
+                        leg->spec_text = NULL;
                     }
+                } else if((buf_len = switch_buffer_peek_zerocopy(leg->chunk_buffer, &chunk_buffer_ptr)) > 0 && chunk_buffer_ptr) {
+                    leg->ep.utterance_ms = ((uint64_t)buf_len * 1000) / (asr_ctx->samplerate * ASR_SAMPLE_BYTES(asr_ctx));
+                    asr_ctx->requests++;
+                    asr_ctx->backend->transcribe(asr_ctx, leg, (switch_byte_t *)chunk_buffer_ptr, buf_len, &globals);
                 }
 
-                schunks = 0;
-                sentence_timeout = 0;
-                unlink(chunk_fname);
-                switch_safe_free(chunk_fname);
-                switch_buffer_zero(chunk_buffer);
+                switch_safe_free(leg->spec_text);
+                leg->spec_len = 0;
+                leg->schunks = 0;
+                leg->sentence_timeout = 0;
+                switch_buffer_zero(leg->chunk_buffer);
             }
         }
 
+        if(asr_ctx->backend->poll) {
+            asr_ctx->backend->poll(asr_ctx, &globals);
+        }
+
         timer_next:
-        switch_yield(10000);
+        switch_mutex_lock(asr_ctx->mutex);
+        if(!globals.fl_shutdown && !asr_ctx->fl_destroyed) {
+            switch_thread_cond_timedwait(asr_ctx->cond, asr_ctx->mutex, 10000);
+        }
+        switch_mutex_unlock(asr_ctx->mutex);
     }
 
 out:
-    if(json != NULL) {
-        cJSON_Delete(json);
+    /* they're out as soon as the session is destroyed, nothing can be running after that */
+    for(i = 0; i < asr_ctx->legs_count; i++) {
+        if(asr_ctx->legs[i].spec_thread) {
+            switch_status_t st = SWITCH_STATUS_SUCCESS;
+            switch_thread_join(&st, asr_ctx->legs[i].spec_thread);
+            asr_ctx->legs[i].spec_thread = NULL;
+        }
     }
-    if(curl_recv_buffer) {
-        switch_buffer_destroy(&curl_recv_buffer);
+    if(asr_ctx->backend->close) {
+        asr_ctx->backend->close(asr_ctx);
+    }
+    if(asr_ctx->curl_multi) {
+        CURLM *curl_multi = NULL;
+
+        switch_mutex_lock(asr_ctx->mutex);
+        curl_multi = asr_ctx->curl_multi;
+        asr_ctx->curl_multi = NULL;
+        switch_mutex_unlock(asr_ctx->mutex);
+
+        curl_multi_cleanup(curl_multi);
     }
-    if(chunk_buffer) {
-        switch_buffer_destroy(&chunk_buffer);
+    for(i = 0; i < asr_ctx->legs_count; i++) {
+        asr_leg_t *leg = &asr_ctx->legs[i];
+
+        if(leg->chunk_buffer) {
+            switch_buffer_destroy(&leg->chunk_buffer);
+        }
+        if(leg->spec_multi) {
+            CURLM *curl_multi = NULL;
+
+            switch_mutex_lock(asr_ctx->mutex);
+            curl_multi = leg->spec_multi;
+            leg->spec_multi = NULL;
+            switch_mutex_unlock(asr_ctx->mutex);
+
+            curl_multi_cleanup(curl_multi);
+        }
+        response_free(&leg->spec_responses[0]);
+        response_free(&leg->spec_responses[1]);
+        switch_safe_free(leg->spec_data);
+        switch_safe_free(leg->spec_text);
     }
     if(pool) {
         switch_core_destroy_memory_pool(&pool);
@@ -393,167 +1015,219 @@ out:
 
     switch_mutex_lock(asr_ctx->mutex);
     if(asr_ctx->refs > 0) asr_ctx->refs--;
+    switch_thread_cond_broadcast(asr_ctx->cond);
     switch_mutex_unlock(asr_ctx->mutex);
 
     switch_mutex_lock(globals.mutex);
     if(globals.active_threads > 0) { globals.active_threads--; }
+    switch_thread_cond_broadcast(globals.cond);
     switch_mutex_unlock(globals.mutex);
 
     return NULL;
 }
 
 // ---------------------------------------------------------------------------------------------------------------------------------------------
-static switch_status_t asr_open(switch_asr_handle_t *ah, const char *codec, int samplerate, const char *dest, switch_asr_flag_t *flags) {
+static switch_status_t asr_ctx_init(asr_ctx_t *asr_ctx, switch_memory_pool_t *pool, asr_codec_t codec, uint32_t samplerate, uint32_t legs_count) {
     switch_status_t status = SWITCH_STATUS_SUCCESS;
-    switch_threadattr_t *attr = NULL;
-    switch_thread_t *thread = NULL;
-    asr_ctx_t *asr_ctx = NULL;
-
-    if(strcmp(codec, "L16") !=0) {
-        switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "Unsupported encoding: %s\n", codec);
-        switch_goto_status(SWITCH_STATUS_FALSE, out);
-    }
-
-    if((asr_ctx = switch_core_alloc(ah->memory_pool, sizeof(asr_ctx_t))) == NULL) {
-        switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "switch_core_alloc()\n");
-        switch_goto_status(SWITCH_STATUS_GENERR, out);
-    }
+    uint32_t i = 0;
 
+    asr_ctx->pool = pool;
+    asr_ctx->codec = codec;
     asr_ctx->chunk_buffer_size = 0;
     asr_ctx->samplerate = samplerate;
     asr_ctx->channels = 1;
-
-   if((status = switch_mutex_init(&asr_ctx->mutex, SWITCH_MUTEX_NESTED, ah->memory_pool)) != SWITCH_STATUS_SUCCESS) {
+    asr_ctx->frame_len = 0;
+    asr_ctx->vad_buffer_size = 0;
+    asr_ctx->legs_count = MIN(legs_count, ASR_LEGS_MAX);
+    asr_ctx->fl_lang_detect = globals.fl_lang_detect;
+    asr_ctx->backend = globals.backend;
+    asr_ctx->fl_endpoint_adaptive = globals.fl_endpoint_adaptive;
+    asr_ctx->endpoint_min_ms = globals.endpoint_min_ms;
+    asr_ctx->endpoint_max_ms = globals.endpoint_max_ms;
+    asr_ctx->fl_speculative = globals.fl_speculative;
+    asr_ctx->fl_capture = globals.fl_capture;
+
+    if((status = switch_mutex_init(&asr_ctx->mutex, SWITCH_MUTEX_NESTED, pool)) != SWITCH_STATUS_SUCCESS) {
         switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "switch_mutex_init()\n");
         switch_goto_status(SWITCH_STATUS_GENERR, out);
     }
+    if((status = switch_thread_cond_create(&asr_ctx->cond, pool)) != SWITCH_STATUS_SUCCESS) {
+        switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "switch_thread_cond_create()\n");
+        switch_goto_status(SWITCH_STATUS_GENERR, out);
+    }
 
-    switch_queue_create(&asr_ctx->q_audio, QUEUE_SIZE, ah->memory_pool);
-    switch_queue_create(&asr_ctx->q_text, QUEUE_SIZE, ah->memory_pool);
+    switch_queue_create(&asr_ctx->q_text, QUEUE_SIZE, pool);
 
-    asr_ctx->vad_buffer = NULL;
-    asr_ctx->frame_len = 0;
-    asr_ctx->vad_buffer_size = 0;
-    asr_ctx->vad_stored_frames = 0;
-    asr_ctx->fl_vad_first_cycle = SWITCH_TRUE;
+    for(i = 0; i < asr_ctx->legs_count; i++) {
+        asr_leg_t *leg = &asr_ctx->legs[i];
 
-    if((asr_ctx->vad = switch_vad_init(asr_ctx->samplerate, asr_ctx->channels)) == NULL) {
-        switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "switch_vad_init()\n");
-        switch_goto_status(SWITCH_STATUS_GENERR, out);
+        leg->name = (i == 0 ? "read" : "write");
+        leg->vad_buffer = NULL;
+        leg->vad_stored_frames = 0;
+        leg->fl_vad_first_cycle = SWITCH_TRUE;
+
+        switch_queue_create(&leg->q_audio, QUEUE_SIZE, pool);
+
+        if((leg->vad = switch_vad_init(asr_ctx->samplerate, asr_ctx->channels)) == NULL) {
+            switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "switch_vad_init()\n");
+            switch_goto_status(SWITCH_STATUS_GENERR, out);
+        }
+        switch_vad_set_mode(leg->vad, -1);
+        switch_vad_set_param(leg->vad, "debug", globals.fl_vad_debug);
+        if(globals.vad_silence_ms > 0)  { switch_vad_set_param(leg->vad, "silence_ms", globals.vad_silence_ms); }
+        if(globals.vad_voice_ms > 0)    { switch_vad_set_param(leg->vad, "voice_ms", globals.vad_voice_ms); }
+        if(globals.vad_threshold > 0)   { switch_vad_set_param(leg->vad, "thresh", globals.vad_threshold); }
     }
-    switch_vad_set_mode(asr_ctx->vad, -1);
-    switch_vad_set_param(asr_ctx->vad, "debug", globals.fl_vad_debug);
-    if(globals.vad_silence_ms > 0)  { switch_vad_set_param(asr_ctx->vad, "silence_ms", globals.vad_silence_ms); }
-    if(globals.vad_voice_ms > 0)    { switch_vad_set_param(asr_ctx->vad, "voice_ms", globals.vad_voice_ms); }
-    if(globals.vad_threshold > 0)   { switch_vad_set_param(asr_ctx->vad, "thresh", globals.vad_threshold); }
 
-    ah->private_info = asr_ctx;
+out:
+    return status;
+}
+
+static switch_status_t asr_ctx_start(asr_ctx_t *asr_ctx) {
+    switch_status_t status = SWITCH_STATUS_SUCCESS;
+    switch_threadattr_t *attr = NULL;
+    switch_thread_t *thread = NULL;
+
+    /* taken here rather than in the thread, so asr_ctx_destroy() can't miss a worker that hasn't started yet */
+    switch_mutex_lock(asr_ctx->mutex);
+    asr_ctx->refs++;
+    switch_mutex_unlock(asr_ctx->mutex);
 
     switch_mutex_lock(globals.mutex);
     globals.active_threads++;
     switch_mutex_unlock(globals.mutex);
 
-    switch_threadattr_create(&attr, ah->memory_pool);
+    switch_threadattr_create(&attr, asr_ctx->pool);
     switch_threadattr_detach_set(attr, 1);
     switch_threadattr_stacksize_set(attr, SWITCH_THREAD_STACKSIZE);
-    switch_thread_create(&thread, attr, transcribe_thread, asr_ctx, ah->memory_pool);
 
-out:
+    if((status = switch_thread_create(&thread, attr, transcribe_thread, asr_ctx, asr_ctx->pool)) != SWITCH_STATUS_SUCCESS) {
+        switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "switch_thread_create()\n");
+
+        switch_mutex_lock(asr_ctx->mutex);
+        asr_ctx->refs--;
+        switch_mutex_unlock(asr_ctx->mutex);
+
+        switch_mutex_lock(globals.mutex);
+        globals.active_threads--;
+        switch_mutex_unlock(globals.mutex);
+    } else {
+        asr_ctx->fl_started = SWITCH_TRUE;
+    }
+
     return status;
 }
 
-static switch_status_t asr_close(switch_asr_handle_t *ah, switch_asr_flag_t *flags) {
-    asr_ctx_t *asr_ctx = (asr_ctx_t *)ah->private_info;
-    uint8_t fl_wloop = SWITCH_TRUE;
-
-    assert(asr_ctx != NULL);
+static void asr_ctx_destroy(asr_ctx_t *asr_ctx) {
+    uint32_t i = 0;
 
-    asr_ctx->fl_abort = SWITCH_TRUE;
-    asr_ctx->fl_destroyed = SWITCH_TRUE;
+    if(asr_ctx->mutex) {
+        switch_mutex_lock(asr_ctx->mutex);
+        asr_ctx->fl_abort = SWITCH_TRUE;
+        asr_ctx->fl_destroyed = SWITCH_TRUE;
 
-    switch_mutex_lock(asr_ctx->mutex);
-    fl_wloop = (asr_ctx->refs != 0);
-    switch_mutex_unlock(asr_ctx->mutex);
+        /* kick the worker out of whatever it's waiting for: the timer, a transfer, the inference queue */
+        if(asr_ctx->cond) {
+            switch_thread_cond_broadcast(asr_ctx->cond);
+        }
+        if(asr_ctx->backend && asr_ctx->backend->wakeup) {
+            asr_ctx->backend->wakeup(asr_ctx);
+        }
 
-    if(fl_wloop) {
-        switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_DEBUG, "Waiting for unlock (refs=%d)...\n", asr_ctx->refs);
-        while(fl_wloop) {
-            switch_mutex_lock(asr_ctx->mutex);
-            fl_wloop = (asr_ctx->refs != 0);
-            switch_mutex_unlock(asr_ctx->mutex);
-            switch_yield(100000);
+        if(asr_ctx->refs != 0) {
+            switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_DEBUG, "Waiting for unlock (refs=%d)...\n", asr_ctx->refs);
+            while(asr_ctx->refs != 0) {
+                switch_thread_cond_wait(asr_ctx->cond, asr_ctx->mutex);
+            }
         }
+        switch_mutex_unlock(asr_ctx->mutex);
     }
 
-    if(asr_ctx->q_audio) {
-        xdata_buffer_queue_clean(asr_ctx->q_audio);
-        switch_queue_term(asr_ctx->q_audio);
+    for(i = 0; i < asr_ctx->legs_count; i++) {
+        asr_leg_t *leg = &asr_ctx->legs[i];
+
+        if(leg->q_audio) {
+            xdata_buffer_queue_clean(leg->q_audio);
+            switch_queue_term(leg->q_audio);
+        }
+        if(leg->vad) {
+            switch_vad_destroy(&leg->vad);
+        }
+        if(leg->vad_buffer) {
+            switch_buffer_destroy(&leg->vad_buffer);
+        }
     }
     if(asr_ctx->q_text) {
-        xdata_buffer_queue_clean(asr_ctx->q_text);
+        asr_results_clean(asr_ctx);
         switch_queue_term(asr_ctx->q_text);
     }
-    if(asr_ctx->vad) {
-        switch_vad_destroy(&asr_ctx->vad);
-    }
-    if(asr_ctx->vad_buffer) {
-        switch_buffer_destroy(&asr_ctx->vad_buffer);
+    response_free(&asr_ctx->responses[0]);
+    response_free(&asr_ctx->responses[1]);
+    if(asr_ctx->capture) {
+        capture_close(&asr_ctx->capture);
     }
-
-    switch_set_flag(ah, SWITCH_ASR_FLAG_CLOSED);
-
-    return SWITCH_STATUS_SUCCESS;
 }
 
-static switch_status_t asr_feed(switch_asr_handle_t *ah, void *data, unsigned int data_len, switch_asr_flag_t *flags) {
-    asr_ctx_t *asr_ctx = (asr_ctx_t *) ah->private_info;
+static switch_status_t asr_ctx_feed(asr_ctx_t *asr_ctx, asr_leg_t *leg, void *data, unsigned int data_len) {
+    int16_t pcm[SWITCH_RECOMMENDED_BUFFER_SIZE / sizeof(int16_t)];
+    uint32_t samples = 0;
     switch_vad_state_t vad_state = 0;
     uint8_t fl_has_audio = SWITCH_FALSE;
 
-    assert(asr_ctx != NULL);
-
-    if(switch_test_flag(ah, SWITCH_ASR_FLAG_CLOSED)) {
-        return SWITCH_STATUS_BREAK;
-    }
-    if(asr_ctx->fl_destroyed || asr_ctx->fl_abort) {
-        return SWITCH_STATUS_BREAK;
-    }
-    if(asr_ctx->fl_pause) {
-        return SWITCH_STATUS_SUCCESS;
-    }
-    if(!data || !data_len) {
-        return SWITCH_STATUS_BREAK;
-    }
-
     if(data_len > 0 && asr_ctx->frame_len == 0) {
         switch_mutex_lock(asr_ctx->mutex);
         asr_ctx->frame_len = data_len;
         asr_ctx->vad_buffer_size = asr_ctx->frame_len * VAD_STORE_FRAMES;
         asr_ctx->chunk_buffer_size = asr_ctx->samplerate * globals.sentence_max_sec;
         switch_mutex_unlock(asr_ctx->mutex);
+    }
 
-        if(switch_buffer_create(ah->memory_pool, &asr_ctx->vad_buffer, asr_ctx->vad_buffer_size) != SWITCH_STATUS_SUCCESS) {
+    if(asr_ctx->fl_capture && !asr_ctx->capture) {
+        switch_mutex_lock(asr_ctx->mutex);
+        if(asr_ctx->fl_capture && !asr_ctx->capture && !(asr_ctx->capture = capture_open(asr_ctx, &globals))) {
+            asr_ctx->fl_capture = SWITCH_FALSE;
+        }
+        switch_mutex_unlock(asr_ctx->mutex);
+    }
+
+    if(asr_ctx->vad_buffer_size && !leg->vad_buffer) {
+        if(switch_buffer_create(asr_ctx->pool, &leg->vad_buffer, asr_ctx->vad_buffer_size) != SWITCH_STATUS_SUCCESS) {
             asr_ctx->vad_buffer_size = 0;
             switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "switch_buffer_create()\n");
         }
     }
 
     if(asr_ctx->vad_buffer_size) {
-        if(asr_ctx->vad_state == SWITCH_VAD_STATE_STOP_TALKING || (asr_ctx->vad_state == vad_state && vad_state == SWITCH_VAD_STATE_NONE)) {
+        if(leg->vad_state == SWITCH_VAD_STATE_STOP_TALKING || (leg->vad_state == vad_state && vad_state == SWITCH_VAD_STATE_NONE)) {
             if(data_len <= asr_ctx->frame_len) {
-                if(asr_ctx->vad_stored_frames >= VAD_STORE_FRAMES) {
-                    switch_buffer_zero(asr_ctx->vad_buffer);
-                    asr_ctx->vad_stored_frames = 0;
-                    asr_ctx->fl_vad_first_cycle = SWITCH_FALSE;
+                if(leg->vad_stored_frames >= VAD_STORE_FRAMES) {
+                    switch_buffer_zero(leg->vad_buffer);
+                    leg->vad_stored_frames = 0;
+                    leg->fl_vad_first_cycle = SWITCH_FALSE;
                 }
-                switch_buffer_write(asr_ctx->vad_buffer, data, MIN(asr_ctx->frame_len, data_len));
-                asr_ctx->vad_stored_frames++;
+                switch_buffer_write(leg->vad_buffer, data, MIN(asr_ctx->frame_len, data_len));
+                leg->vad_stored_frames++;
             }
         }
 
-        vad_state = switch_vad_process(asr_ctx->vad, (int16_t *)data, (data_len / sizeof(int16_t)));
+        if(asr_ctx->codec == ASR_CODEC_L16) {
+            vad_state = switch_vad_process(leg->vad, (int16_t *)data, (data_len / sizeof(int16_t)));
+        } else {
+            /* the buffers keep G.711 as is, only the VAD gets the expanded copy */
+            samples = MIN(data_len, switch_arraylen(pcm));
+            g711_decode(asr_ctx->codec, (uint8_t *)data, samples, pcm);
+            vad_state = switch_vad_process(leg->vad, pcm, samples);
+        }
+        endpointer_feed(asr_ctx, leg, data_len, vad_state);
+
+        /* the worker and the speculative request read it, only this thread writes it */
+        if(vad_state != leg->vad_state && (vad_state == SWITCH_VAD_STATE_START_TALKING || vad_state == SWITCH_VAD_STATE_STOP_TALKING || vad_state == SWITCH_VAD_STATE_TALKING)) {
+            switch_mutex_lock(asr_ctx->mutex);
+            leg->vad_state = vad_state;
+            switch_mutex_unlock(asr_ctx->mutex);
+        }
+
         if(vad_state == SWITCH_VAD_STATE_START_TALKING) {
-            asr_ctx->vad_state = vad_state;
             fl_has_audio = SWITCH_TRUE;
             switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_DEBUG, "ki log asr vad start talking, session_uuid is %s\n", asr_ctx->session_uuid);
             if(asr_ctx->session_uuid){
@@ -562,32 +1236,37 @@ static switch_status_t asr_feed(switch_asr_handle_t *ah, void *data, unsigned in
                 if (switch_event_create_subclass(&event, SWITCH_EVENT_CUSTOM, VAD_EVENT) == SWITCH_STATUS_SUCCESS) {
                     switch_event_add_header_string(event, SWITCH_STACK_BOTTOM, "VAD_Type", "start");
                     switch_event_add_header_string(event, SWITCH_STACK_BOTTOM, "Unique-ID", asr_ctx->session_uuid);
+                    if(asr_ctx->bug) {
+                        switch_event_add_header_string(event, SWITCH_STACK_BOTTOM, "Speaker-Leg", leg->name);
+                    }
                     // DUMP_EVENT(event);
                     switch_event_fire(&event);
                 }
             } 
         } else if (vad_state == SWITCH_VAD_STATE_STOP_TALKING) {
-            asr_ctx->vad_state = vad_state;
             fl_has_audio = SWITCH_FALSE;
-            switch_vad_reset(asr_ctx->vad);
+            switch_vad_reset(leg->vad);
         } else if (vad_state == SWITCH_VAD_STATE_TALKING) {
-            asr_ctx->vad_state = vad_state;
             fl_has_audio = SWITCH_TRUE;
         }
     } else {
         fl_has_audio = SWITCH_TRUE;
     }
 
+    if(asr_ctx->capture) {
+        capture_write(asr_ctx->capture, (leg - asr_ctx->legs), data, data_len, vad_state);
+    }
+
     if(fl_has_audio) {
-        if(vad_state == SWITCH_VAD_STATE_START_TALKING && asr_ctx->vad_stored_frames > 0) {
+        if(vad_state == SWITCH_VAD_STATE_START_TALKING && leg->vad_stored_frames > 0) {
             xdata_buffer_t *tau_buf = NULL;
             const void *ptr = NULL;
             switch_size_t vblen = 0;
             uint32_t rframes = 0, rlen = 0;
             int ofs = 0;
 
-            if((vblen = switch_buffer_peek_zerocopy(asr_ctx->vad_buffer, &ptr)) && ptr && vblen > 0) {
-                rframes = (asr_ctx->vad_stored_frames >= VAD_RECOVERY_FRAMES ? VAD_RECOVERY_FRAMES : (asr_ctx->fl_vad_first_cycle ? asr_ctx->vad_stored_frames : VAD_RECOVERY_FRAMES));
+            if((vblen = switch_buffer_peek_zerocopy(leg->vad_buffer, &ptr)) && ptr && vblen > 0) {
+                rframes = (leg->vad_stored_frames >= VAD_RECOVERY_FRAMES ? VAD_RECOVERY_FRAMES : (leg->fl_vad_first_cycle ? leg->vad_stored_frames : VAD_RECOVERY_FRAMES));
                 rlen = (rframes * asr_ctx->frame_len);
                 ofs = (vblen - rlen);
 
@@ -604,12 +1283,12 @@ static switch_status_t asr_feed(switch_asr_handle_t *ah, void *data, unsigned in
                     memcpy(tau_buf->data + hdr_sz , (void *)((char *)ptr + 0), vblen);
                     memcpy(tau_buf->data + rlen, data, data_len);
 
-                    if(switch_queue_trypush(asr_ctx->q_audio, tau_buf) != SWITCH_STATUS_SUCCESS) {
+                    if(switch_queue_trypush(leg->q_audio, tau_buf) != SWITCH_STATUS_SUCCESS) {
                         xdata_buffer_free(&tau_buf);
                     }
 
-                    switch_buffer_zero(asr_ctx->vad_buffer);
-                    asr_ctx->vad_stored_frames = 0;
+                    switch_buffer_zero(leg->vad_buffer);
+                    leg->vad_stored_frames = 0;
                 } else {
                     switch_zmalloc(tau_buf, sizeof(xdata_buffer_t));
 
@@ -619,20 +1298,101 @@ static switch_status_t asr_feed(switch_asr_handle_t *ah, void *data, unsigned in
                     memcpy(tau_buf->data, (void *)((char *)ptr + ofs), rlen);
                     memcpy(tau_buf->data + rlen, data, data_len);
 
-                    if(switch_queue_trypush(asr_ctx->q_audio, tau_buf) != SWITCH_STATUS_SUCCESS) {
+                    if(switch_queue_trypush(leg->q_audio, tau_buf) != SWITCH_STATUS_SUCCESS) {
                         xdata_buffer_free(&tau_buf);
                     }
 
-                    switch_buffer_zero(asr_ctx->vad_buffer);
-                    asr_ctx->vad_stored_frames = 0;
+                    switch_buffer_zero(leg->vad_buffer);
+                    leg->vad_stored_frames = 0;
                 }
             }
         } else {
-            xdata_buffer_push(asr_ctx->q_audio, data, data_len);
+            xdata_buffer_push(leg->q_audio, data, data_len);
+        }
+    }
+
+    return SWITCH_STATUS_SUCCESS;
+}
+
+// ---------------------------------------------------------------------------------------------------------------------------------------------
+static void asr_text_param(switch_asr_handle_t *ah, char *param, const char *val);
+
+static switch_status_t asr_open(switch_asr_handle_t *ah, const char *codec, int samplerate, const char *dest, switch_asr_flag_t *flags) {
+    switch_status_t status = SWITCH_STATUS_SUCCESS;
+    asr_ctx_t *asr_ctx = NULL;
+    asr_codec_t asr_codec = g711_codec_lookup(codec);
+
+    if(asr_codec == ASR_CODEC_NONE) {
+        switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "Unsupported encoding: %s\n", codec);
+        switch_goto_status(SWITCH_STATUS_FALSE, out);
+    }
+
+    if((asr_ctx = switch_core_alloc(ah->memory_pool, sizeof(asr_ctx_t))) == NULL) {
+        switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "switch_core_alloc()\n");
+        switch_goto_status(SWITCH_STATUS_GENERR, out);
+    }
+
+    if((status = asr_ctx_init(asr_ctx, ah->memory_pool, asr_codec, samplerate, 1)) != SWITCH_STATUS_SUCCESS) {
+        asr_ctx_destroy(asr_ctx);
+        goto out;
+    }
+
+    /* "openai:backend=mock,capture=false" - applied before the worker starts, the backend can't change after that */
+    ah->private_info = asr_ctx;
+    if(!zstr(ah->param)) {
+        char *params = switch_core_strdup(ah->memory_pool, ah->param), *argv[16] = { 0 };
+        int argc = switch_separate_string(params, ',', argv, switch_arraylen(argv)), i = 0;
+
+        for(i = 0; i < argc; i++) {
+            char *val = strchr(argv[i], '=');
+            if(val) {
+                *val++ = '\0';
+                asr_text_param(ah, argv[i], val);
+            }
         }
     }
 
-    return SWITCH_STATUS_SUCCESS;
+    if((status = asr_ctx_start(asr_ctx)) != SWITCH_STATUS_SUCCESS) {
+        ah->private_info = NULL;
+        asr_ctx_destroy(asr_ctx);
+        goto out;
+    }
+
+out:
+    return status;
+}
+
+static switch_status_t asr_close(switch_asr_handle_t *ah, switch_asr_flag_t *flags) {
+    asr_ctx_t *asr_ctx = (asr_ctx_t *)ah->private_info;
+
+    assert(asr_ctx != NULL);
+
+    asr_ctx_destroy(asr_ctx);
+
+    switch_set_flag(ah, SWITCH_ASR_FLAG_CLOSED);
+
+    return SWITCH_STATUS_SUCCESS;
+}
+
+static switch_status_t asr_feed(switch_asr_handle_t *ah, void *data, unsigned int data_len, switch_asr_flag_t *flags) {
+    asr_ctx_t *asr_ctx = (asr_ctx_t *) ah->private_info;
+
+    assert(asr_ctx != NULL);
+
+    if(switch_test_flag(ah, SWITCH_ASR_FLAG_CLOSED)) {
+        return SWITCH_STATUS_BREAK;
+    }
+    if(asr_ctx->fl_destroyed || asr_ctx->fl_abort) {
+        return SWITCH_STATUS_BREAK;
+    }
+    if(asr_ctx->fl_pause) {
+        return SWITCH_STATUS_SUCCESS;
+    }
+    if(!data || !data_len) {
+        return SWITCH_STATUS_BREAK;
+    }
+
+    return asr_ctx_feed(asr_ctx, &asr_ctx->legs[0], data, data_len);
 }
 
 static switch_status_t asr_check_results(switch_asr_handle_t *ah, switch_asr_flag_t *flags) {
@@ -650,13 +1410,9 @@ static switch_status_t asr_get_results(switch_asr_handle_t *ah, char **xmlstr, s
 
     assert(asr_ctx != NULL);
 
+    /* the queued text itself goes to the caller, who frees it */
     if(switch_queue_trypop(asr_ctx->q_text, &pop) == SWITCH_STATUS_SUCCESS) {
-        xdata_buffer_t *tbuff = (xdata_buffer_t *)pop;
-        if(tbuff->len > 0) {
-            switch_zmalloc(result, tbuff->len + 1);
-            memcpy(result, tbuff->data, tbuff->len);
-        }
-        xdata_buffer_free(&tbuff);
+        result = (char *)pop;
 
         switch_mutex_lock(asr_ctx->mutex);
         if(asr_ctx->transcription_results > 0) asr_ctx->transcription_results--;
@@ -699,6 +1455,21 @@ static switch_status_t asr_resume(switch_asr_handle_t *ah) {
     return SWITCH_STATUS_SUCCESS;
 }
 
+static void asr_numeric_param(switch_asr_handle_t *ah, char *param, int val) {
+    asr_ctx_t *asr_ctx = (asr_ctx_t *)ah->private_info;
+
+    assert(asr_ctx != NULL);
+
+    if(strcasecmp(param, "endpoint_adaptive") == 0) {
+        asr_ctx->fl_endpoint_adaptive = (val ? SWITCH_TRUE : SWITCH_FALSE);
+    } else if(strcasecmp(param, "endpoint_min_ms") == 0) {
+        if(val > 0) asr_ctx->endpoint_min_ms = val;
+    } else if(strcasecmp(param, "endpoint_max_ms") == 0) {
+        if(val > 0) asr_ctx->endpoint_max_ms = val;
+    }
+    asr_ctx->endpoint_max_ms = MAX(asr_ctx->endpoint_max_ms, asr_ctx->endpoint_min_ms);
+}
+
 static void asr_text_param(switch_asr_handle_t *ah, char *param, const char *val) {
     asr_ctx_t *asr_ctx = (asr_ctx_t *)ah->private_info;
 
@@ -706,6 +1477,17 @@ static void asr_text_param(switch_asr_handle_t *ah, char *param, const char *val
 
     if(strcasecmp(param, "language") == 0) {
         if(val) asr_ctx->opt_lang = switch_core_strdup(ah->memory_pool, val);
+    } else if(strcasecmp(param, "backend") == 0) {
+        asr_backend_t *backend = backend_lookup(val);
+        if(asr_ctx->fl_started) {
+            switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_WARNING, "The backend can't be changed once recognition has started (use openai:backend=%s)\n", (val ? val : ""));
+        } else if(backend) {
+            asr_ctx->backend = backend;
+        } else {
+            switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_WARNING, "Unknown backend: %s\n", val);
+        }
+    } else if(strcasecmp(param, "language_detect") == 0) {
+        if(val) asr_ctx->fl_lang_detect = switch_true(val);
     } else if(strcasecmp(param, "model") == 0) {
         if(val) asr_ctx->opt_model = switch_core_strdup(ah->memory_pool, val);
     } else if(strcasecmp(param, "session_uuid") == 0) {
@@ -714,13 +1496,18 @@ static void asr_text_param(switch_asr_handle_t *ah, char *param, const char *val
         if(val) asr_ctx->caller_no = switch_core_strdup(ah->memory_pool, val);
     } else if(strcasecmp(param, "dest_no") == 0) {
         if(val) asr_ctx->dest_no = switch_core_strdup(ah->memory_pool, val);
+    } else if(strcasecmp(param, "speculative") == 0) {
+        if(val) asr_ctx->fl_speculative = switch_true(val);
+    } else if(strcasecmp(param, "capture") == 0) {
+        if(val) asr_ctx->fl_capture = switch_true(val);
+    } else if(strcasecmp(param, "endpoint_adaptive") == 0) {
+        if(val) asr_numeric_param(ah, param, switch_true(val));
+    } else if(strncasecmp(param, "endpoint_", 9) == 0) {
+        if(val) asr_numeric_param(ah, param, atoi(val));
     }
 
 }
 
-static void asr_numeric_param(switch_asr_handle_t *ah, char *param, int val) {
-}
-
 static void asr_float_param(switch_asr_handle_t *ah, char *param, double val) {
 }
 
@@ -732,6 +1519,492 @@ static switch_status_t asr_unload_grammar(switch_asr_handle_t *ah, const char *n
     return SWITCH_STATUS_SUCCESS;
 }
 
+// ---------------------------------------------------------------------------------------------------------------------------------------------
+// media bug
+// ---------------------------------------------------------------------------------------------------------------------------------------------
+static switch_bool_t bug_callback(switch_media_bug_t *bug, void *user_data, switch_abc_type_t type) {
+    asr_ctx_t *asr_ctx = (asr_ctx_t *)user_data;
+
+    switch(type) {
+        case SWITCH_ABC_TYPE_INIT:
+            break;
+
+        case SWITCH_ABC_TYPE_CLOSE:
+            asr_ctx_destroy(asr_ctx);
+            break;
+
+        case SWITCH_ABC_TYPE_READ: {
+            uint8_t data[SWITCH_RECOMMENDED_BUFFER_SIZE];
+            int16_t legs_data[ASR_LEGS_MAX][SWITCH_RECOMMENDED_BUFFER_SIZE / (sizeof(int16_t) * ASR_LEGS_MAX)];
+            switch_frame_t frame = { 0 };
+            uint32_t samples = 0, i = 0;
+
+            frame.data = data;
+            frame.buflen = sizeof(data);
+
+            if(asr_ctx->fl_destroyed || asr_ctx->fl_abort || asr_ctx->fl_pause) {
+                break;
+            }
+
+            /* SMBF_STEREO: read leg on the left, write leg on the right */
+            while(switch_core_media_bug_read(bug, &frame, SWITCH_FALSE) == SWITCH_STATUS_SUCCESS) {
+                if(!frame.datalen) {
+                    break;
+                }
+                samples = MIN(frame.datalen / (sizeof(int16_t) * ASR_LEGS_MAX), switch_arraylen(legs_data[0]));
+                for(i = 0; i < samples; i++) {
+                    legs_data[0][i] = ((int16_t *)data)[i * 2];
+                    legs_data[1][i] = ((int16_t *)data)[i * 2 + 1];
+                }
+                for(i = 0; i < asr_ctx->legs_count; i++) {
+                    asr_ctx_feed(asr_ctx, &asr_ctx->legs[i], legs_data[i], samples * sizeof(int16_t));
+                }
+            }
+            break;
+        }
+
+        /* SMBF_TAP_NATIVE_*: the encoded G.711 frames, each leg comes on its own */
+        case SWITCH_ABC_TYPE_TAP_NATIVE_READ:
+        case SWITCH_ABC_TYPE_TAP_NATIVE_WRITE: {
+            switch_frame_t *frame = NULL;
+
+            if(asr_ctx->fl_destroyed || asr_ctx->fl_abort || asr_ctx->fl_pause) {
+                break;
+            }
+
+            frame = (type == SWITCH_ABC_TYPE_TAP_NATIVE_READ ? switch_core_media_bug_get_native_read_frame(bug) : switch_core_media_bug_get_native_write_frame(bug));
+            if(frame && frame->datalen && !switch_test_flag(frame, SFF_CNG)) {
+                asr_ctx_feed(asr_ctx, &asr_ctx->legs[(type == SWITCH_ABC_TYPE_TAP_NATIVE_READ ? 0 : 1)], frame->data, frame->datalen);
+            }
+            break;
+        }
+
+        default:
+            break;
+    }
+
+    return SWITCH_TRUE;
+}
+
+static switch_status_t bug_start(switch_core_session_t *session, const char *lang) {
+    switch_status_t status = SWITCH_STATUS_SUCCESS;
+    switch_channel_t *channel = switch_core_session_get_channel(session);
+    switch_codec_implementation_t read_impl = { 0 };
+    switch_codec_implementation_t write_impl = { 0 };
+    switch_media_bug_t *bug = NULL;
+    asr_ctx_t *asr_ctx = NULL;
+    asr_codec_t codec = ASR_CODEC_L16;
+    uint32_t bug_flags = (SMBF_READ_STREAM | SMBF_WRITE_STREAM | SMBF_STEREO | SMBF_READ_PING);
+    const char *val = NULL;
+
+    if(switch_channel_get_private(channel, BUG_NAME)) {
+        switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(session), SWITCH_LOG_ERROR, "Transcription is already running on %s\n", switch_channel_get_name(channel));
+        switch_goto_status(SWITCH_STATUS_FALSE, out);
+    }
+
+    switch_core_session_get_read_impl(session, &read_impl);
+    switch_core_session_get_write_impl(session, &write_impl);
+
+    /* both legs in the same G.711 flavour: take the frames before the core decodes them */
+    if(globals.fl_g711_native && !zstr(read_impl.iananame) && !zstr(write_impl.iananame) && !strcasecmp(read_impl.iananame, write_impl.iananame)) {
+        if((codec = g711_codec_lookup(read_impl.iananame)) == ASR_CODEC_PCMU || codec == ASR_CODEC_PCMA) {
+            bug_flags = (SMBF_TAP_NATIVE_READ | SMBF_TAP_NATIVE_WRITE);
+        } else {
+            codec = ASR_CODEC_L16;
+        }
+    }
+
+    if((asr_ctx = switch_core_session_alloc(session, sizeof(asr_ctx_t))) == NULL) {
+        switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "switch_core_session_alloc()\n");
+        switch_goto_status(SWITCH_STATUS_GENERR, out);
+    }
+
+    if((status = asr_ctx_init(asr_ctx, switch_core_session_get_pool(session), codec, read_impl.actual_samples_per_second, ASR_LEGS_MAX)) != SWITCH_STATUS_SUCCESS) {
+        asr_ctx_destroy(asr_ctx);
+        goto out;
+    }
+
+    asr_ctx->session_uuid = switch_core_session_strdup(session, switch_core_session_get_uuid(session));
+    if(!zstr(lang)) {
+        asr_ctx->opt_lang = switch_core_session_strdup(session, lang);
+    }
+    if((val = switch_channel_get_variable(channel, "openai_asr_backend")) && backend_lookup(val)) {
+        asr_ctx->backend = backend_lookup(val);
+    }
+    if((val = switch_channel_get_variable(channel, "openai_asr_speculative"))) {
+        asr_ctx->fl_speculative = switch_true(val);
+    }
+    if((val = switch_channel_get_variable(channel, "openai_asr_capture"))) {
+        asr_ctx->fl_capture = switch_true(val);
+    }
+    if((val = switch_channel_get_variable(channel, "openai_asr_endpoint_adaptive"))) {
+        asr_ctx->fl_endpoint_adaptive = switch_true(val);
+    }
+    if((val = switch_channel_get_variable(channel, "openai_asr_endpoint_min_ms")) && atoi(val) > 0) {
+        asr_ctx->endpoint_min_ms = atoi(val);
+    }
+    if((val = switch_channel_get_variable(channel, "openai_asr_endpoint_max_ms")) && atoi(val) > 0) {
+        asr_ctx->endpoint_max_ms = MAX(atoi(val), asr_ctx->endpoint_min_ms);
+    }
+    if((val = switch_channel_get_variable(channel, "caller_id_number"))) {
+        asr_ctx->caller_no = switch_core_session_strdup(session, val);
+    }
+    if((val = switch_channel_get_variable(channel, "destination_number"))) {
+        asr_ctx->dest_no = switch_core_session_strdup(session, val);
+    }
+
+    if((status = switch_core_media_bug_add(session, BUG_NAME, NULL, bug_callback, asr_ctx, 0, bug_flags, &bug)) != SWITCH_STATUS_SUCCESS) {
+        switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(session), SWITCH_LOG_ERROR, "switch_core_media_bug_add()\n");
+        asr_ctx_destroy(asr_ctx);
+        goto out;
+    }
+
+    asr_ctx->bug = bug;
+
+    /* removing the bug destroys the context (SWITCH_ABC_TYPE_CLOSE) */
+    if((status = asr_ctx_start(asr_ctx)) != SWITCH_STATUS_SUCCESS) {
+        switch_core_media_bug_remove(session, &bug);
+        goto out;
+    }
+
+    switch_channel_set_private(channel, BUG_NAME, bug);
+
+out:
+    return status;
+}
+
+static switch_status_t bug_stop(switch_core_session_t *session) {
+    switch_channel_t *channel = switch_core_session_get_channel(session);
+    switch_media_bug_t *bug = (switch_media_bug_t *)switch_channel_get_private(channel, BUG_NAME);
+
+    if(!bug) {
+        return SWITCH_STATUS_FALSE;
+    }
+
+    switch_channel_set_private(channel, BUG_NAME, NULL);
+    return switch_core_media_bug_remove(session, &bug);
+}
+
+#define OPENAI_ASR_BENCH_SYNTAX "<file> [iterations] [backend]"
+SWITCH_STANDARD_API(openai_asr_bench_function) {
+    switch_memory_pool_t *pool = NULL;
+    switch_buffer_t *audio_buffer = NULL;
+    switch_file_handle_t fh = { 0 };
+    asr_ctx_t *asr_ctx = NULL;
+    char *mycmd = NULL, *argv[3] = { 0 };
+    int16_t frame[SWITCH_RECOMMENDED_BUFFER_SIZE / sizeof(int16_t)];
+    const void *audio_ptr = NULL;
+    switch_size_t len = 0, audio_len = 0;
+    uint32_t iterations = 1, samplerate = 16000, b = 0, n = 0;
+    uint8_t fl_fopen = SWITCH_FALSE;
+    int argc = 0;
+
+    if(!zstr(cmd)) {
+        mycmd = strdup(cmd);
+        argc = switch_separate_string(mycmd, ' ', argv, switch_arraylen(argv));
+    }
+    if(argc < 1) {
+        stream->write_function(stream, "-USAGE: %s\n", OPENAI_ASR_BENCH_SYNTAX);
+        goto out;
+    }
+    if(argc > 1 && atoi(argv[1]) > 0) {
+        iterations = atoi(argv[1]);
+    }
+    if(argc > 2 && !backend_lookup(argv[2])) {
+        stream->write_function(stream, "-ERR: unknown backend\n");
+        goto out;
+    }
+
+    if(switch_core_new_memory_pool(&pool) != SWITCH_STATUS_SUCCESS) {
+        stream->write_function(stream, "-ERR: switch_core_new_memory_pool()\n");
+        goto out;
+    }
+    if(switch_core_file_open(&fh, argv[0], 1, samplerate, (SWITCH_FILE_FLAG_READ | SWITCH_FILE_DATA_SHORT), pool) != SWITCH_STATUS_SUCCESS) {
+        stream->write_function(stream, "-ERR: unable to open file (%s)\n", argv[0]);
+        goto out;
+    }
+    fl_fopen = SWITCH_TRUE;
+
+    switch_buffer_create_dynamic(&audio_buffer, SWITCH_RECOMMENDED_BUFFER_SIZE, SWITCH_RECOMMENDED_BUFFER_SIZE, 0);
+    while(SWITCH_TRUE) {
+        len = switch_arraylen(frame);
+        if(switch_core_file_read(&fh, frame, &len) != SWITCH_STATUS_SUCCESS || len == 0) {
+            break;
+        }
+        switch_buffer_write(audio_buffer, frame, len * sizeof(int16_t));
+    }
+    if((audio_len = switch_buffer_peek_zerocopy(audio_buffer, &audio_ptr)) == 0) {
+        stream->write_function(stream, "-ERR: file is empty\n");
+        goto out;
+    }
+
+    asr_ctx = switch_core_alloc(pool, sizeof(asr_ctx_t));
+    if(asr_ctx_init(asr_ctx, pool, ASR_CODEC_L16, samplerate, 1) != SWITCH_STATUS_SUCCESS) {
+        stream->write_function(stream, "-ERR: asr_ctx_init()\n");
+        goto out;
+    }
+    asr_ctx->fl_lang_detect = SWITCH_FALSE;
+
+    stream->write_function(stream, "audio: %.2f sec, iterations: %d\n", (double)audio_len / (samplerate * sizeof(int16_t)), iterations);
+    stream->write_function(stream, "%-10s %8s %10s %10s %10s %8s\n", "backend", "ok", "avg-ms", "min-ms", "max-ms", "rtf");
+
+    for(b = 0; backends[b]; b++) {
+        switch_time_t lat_sum = 0, lat_min = 0, lat_max = 0;
+        uint32_t ok = 0;
+
+        if(argc > 2 && strcasecmp(argv[2], backends[b]->name)) {
+            continue;
+        }
+
+        asr_ctx->backend = backends[b];
+        for(n = 0; n < iterations; n++) {
+            switch_time_t started = switch_micro_time_now(), lat = 0;
+
+            if(asr_ctx->backend->transcribe(asr_ctx, &asr_ctx->legs[0], (switch_byte_t *)audio_ptr, audio_len, &globals) == SWITCH_STATUS_SUCCESS) {
+                ok++;
+            }
+            lat = (switch_micro_time_now() - started);
+            lat_sum += lat;
+            lat_min = (n == 0 ? lat : MIN(lat_min, lat));
+            lat_max = MAX(lat_max, lat);
+        }
+        if(asr_ctx->backend->close) {
+            asr_ctx->backend->close(asr_ctx);
+        }
+        asr_results_clean(asr_ctx);
+
+        stream->write_function(stream, "%-10s %4d/%-3d %10.1f %10.1f %10.1f %8.3f\n", backends[b]->name, ok, iterations,
+            (double)lat_sum / iterations / 1000, (double)lat_min / 1000, (double)lat_max / 1000,
+            ((double)lat_sum / iterations / 1000000) / ((double)audio_len / (samplerate * sizeof(int16_t))));
+    }
+
+out:
+    if(asr_ctx) {
+        asr_ctx_destroy(asr_ctx);
+    }
+    if(audio_buffer) {
+        switch_buffer_destroy(&audio_buffer);
+    }
+    if(fl_fopen) {
+        switch_core_file_close(&fh);
+    }
+    if(pool) {
+        switch_core_destroy_memory_pool(&pool);
+    }
+    switch_safe_free(mycmd);
+    return SWITCH_STATUS_SUCCESS;
+}
+
+#define REPLAY_LATENCIES_MAX    4096
+#define REPLAY_DRAIN_SEC        30
+
+static int replay_latency_cmp(const void *a, const void *b) {
+    switch_time_t x = *(const switch_time_t *)a, y = *(const switch_time_t *)b;
+    return (x < y ? -1 : (x > y ? 1 : 0));
+}
+
+/* latency is counted from the last STOP_TALKING of the leg to its result */
+static uint32_t replay_collect(switch_asr_handle_t *ah, switch_time_t *stopped, switch_time_t *latencies, uint32_t *latencies_count) {
+    switch_asr_flag_t flags = SWITCH_ASR_FLAG_NONE;
+    char *text = NULL;
+    uint32_t results = 0;
+
+    while(switch_core_asr_check_results(ah, &flags) == SWITCH_STATUS_SUCCESS) {
+        if(switch_core_asr_get_results(ah, &text, &flags) != SWITCH_STATUS_SUCCESS) {
+            break;
+        }
+        if(*stopped && *latencies_count < REPLAY_LATENCIES_MAX) {
+            latencies[(*latencies_count)++] = (switch_micro_time_now() - *stopped);
+        }
+        *stopped = 0;
+        switch_safe_free(text);
+        results++;
+    }
+    return results;
+}
+
+#define OPENAI_ASR_REPLAY_SYNTAX "<file> [speed] [backend] [from-sec]"
+SWITCH_STANDARD_API(openai_asr_replay_function) {
+    switch_memory_pool_t *pool = NULL;
+    switch_asr_handle_t ah[ASR_LEGS_MAX];
+    switch_time_t stopped[ASR_LEGS_MAX] = { 0 };
+    switch_time_t *latencies = NULL;
+    switch_asr_flag_t flags = SWITCH_ASR_FLAG_NONE;
+    capture_reader_t rd = { 0 };
+    capture_frame_t frame = { 0 };
+    char *mycmd = NULL, *argv[4] = { 0 }, module_name[128] = { 0 };
+    const char *backend_name = backend_mock.name;
+    switch_time_t started = 0, now = 0, drain_until = 0, lat_sum = 0;
+    uint64_t first_ts = 0, from_ts = 0, audio_bytes = 0;
+    uint32_t legs_open = 0, frames = 0, results = 0, requests = 0, latencies_count = 0, i = 0;
+    uint8_t fl_first = SWITCH_TRUE, fl_pending = SWITCH_FALSE;
+    double speed = 1.0;
+    int argc = 0;
+
+    memset(ah, 0, sizeof(ah));
+
+    if(!zstr(cmd)) {
+        mycmd = strdup(cmd);
+        argc = switch_separate_string(mycmd, ' ', argv, switch_arraylen(argv));
+    }
+    if(argc < 1) {
+        stream->write_function(stream, "-USAGE: %s\n", OPENAI_ASR_REPLAY_SYNTAX);
+        goto out;
+    }
+    if(argc > 1) {
+        speed = MAX(atof(argv[1]), 0);
+    }
+    if(argc > 2) {
+        if(!backend_lookup(argv[2])) {
+            stream->write_function(stream, "-ERR: unknown backend\n");
+            goto out;
+        }
+        backend_name = argv[2];
+    }
+    if(argc > 3 && atof(argv[3]) > 0) {
+        from_ts = (uint64_t)(atof(argv[3]) * 1000000);
+    }
+
+    if(capture_reader_open(&rd, argv[0]) != SWITCH_STATUS_SUCCESS) {
+        stream->write_function(stream, "-ERR: unable to open capture (%s)\n", argv[0]);
+        goto out;
+    }
+    if(switch_core_new_memory_pool(&pool) != SWITCH_STATUS_SUCCESS) {
+        stream->write_function(stream, "-ERR: switch_core_new_memory_pool()\n");
+        goto out;
+    }
+    switch_zmalloc(latencies, REPLAY_LATENCIES_MAX * sizeof(switch_time_t));
+
+    /* every leg goes through its own handle, the same way detect_speech feeds the module */
+    switch_snprintf(module_name, sizeof(module_name), "openai:backend=%s,capture=false", backend_name);
+    for(legs_open = 0; legs_open < rd.legs; legs_open++) {
+        if(switch_core_asr_open(&ah[legs_open], module_name, g711_codec_name(rd.codec), rd.samplerate, "", &flags, pool) != SWITCH_STATUS_SUCCESS) {
+            stream->write_function(stream, "-ERR: switch_core_asr_open()\n");
+            goto out;
+        }
+    }
+
+    capture_reader_seek(&rd, from_ts);
+    started = switch_micro_time_now();
+
+    while(capture_reader_next(&rd, &frame)) {
+        if(frame.ts < from_ts) {
+            continue;
+        }
+        if(fl_first) {
+            first_ts = frame.ts;
+            fl_first = SWITCH_FALSE;
+        }
+        if(speed > 0) {
+            switch_time_t due = started + (switch_time_t)((frame.ts - first_ts) / speed);
+
+            while((now = switch_micro_time_now()) < due) {
+                for(i = 0; i < legs_open; i++) {
+                    results += replay_collect(&ah[i], &stopped[i], latencies, &latencies_count);
+                }
+                switch_yield(MIN(due - now, 10000));
+            }
+        }
+
+        switch_core_asr_feed(&ah[frame.leg], (void *)frame.data, frame.len, &flags);
+        if(frame.vad == SWITCH_VAD_STATE_STOP_TALKING) {
+            stopped[frame.leg] = switch_micro_time_now();
+        }
+        frames++;
+        audio_bytes += frame.len;
+
+        results += replay_collect(&ah[frame.leg], &stopped[frame.leg], latencies, &latencies_count);
+    }
+
+    /* the last utterances are still waiting for their deadlines */
+    drain_until = switch_micro_time_now() + (REPLAY_DRAIN_SEC * 1000000);
+    while(switch_micro_time_now() < drain_until) {
+        fl_pending = SWITCH_FALSE;
+        for(i = 0; i < legs_open; i++) {
+            results += replay_collect(&ah[i], &stopped[i], latencies, &latencies_count);
+            fl_pending |= (stopped[i] != 0);
+        }
+        if(!fl_pending) {
+            break;
+        }
+        switch_yield(10000);
+    }
+
+    for(i = 0; i < legs_open; i++) {
+        requests += ((asr_ctx_t *)ah[i].private_info)->requests;
+    }
+
+    stream->write_function(stream, "capture: %s, %s/%d, legs: %d\n", argv[0], g711_codec_name(rd.codec), rd.samplerate, rd.legs);
+    stream->write_function(stream, "frames: %d, audio: %.2f sec, wall: %.2f sec, speed: %.2fx, backend: %s\n", frames,
+        (double)audio_bytes / (rd.samplerate * (rd.codec == ASR_CODEC_L16 ? sizeof(int16_t) : 1)) / rd.legs,
+        (double)(switch_micro_time_now() - started) / 1000000, speed, backend_name);
+    stream->write_function(stream, "requests: %d, results: %d\n", requests, results);
+
+    if(latencies_count > 0) {
+        qsort(latencies, latencies_count, sizeof(switch_time_t), replay_latency_cmp);
+        for(i = 0; i < latencies_count; i++) {
+            lat_sum += latencies[i];
+        }
+        stream->write_function(stream, "latency-ms: avg %.1f, p50 %.1f, p95 %.1f, max %.1f (%d)\n",
+            (double)lat_sum / latencies_count / 1000, (double)latencies[latencies_count / 2] / 1000,
+            (double)latencies[(latencies_count * 95) / 100] / 1000, (double)latencies[latencies_count - 1] / 1000, latencies_count);
+    } else {
+        stream->write_function(stream, "latency-ms: -\n");
+    }
+
+out:
+    for(i = 0; i < legs_open; i++) {
+        switch_core_asr_close(&ah[i], &flags);
+    }
+    if(pool) {
+        switch_core_destroy_memory_pool(&pool);
+    }
+    capture_reader_close(&rd);
+    switch_safe_free(latencies);
+    switch_safe_free(mycmd);
+    return SWITCH_STATUS_SUCCESS;
+}
+
+#define UUID_OPENAI_ASR_SYNTAX "start|stop <uuid> [language]"
+SWITCH_STANDARD_API(uuid_openai_asr_function) {
+    switch_status_t status = SWITCH_STATUS_FALSE;
+    switch_core_session_t *lsession = NULL;
+    char *mycmd = NULL, *argv[3] = { 0 };
+    int argc = 0;
+
+    if(!zstr(cmd)) {
+        mycmd = strdup(cmd);
+        argc = switch_separate_string(mycmd, ' ', argv, switch_arraylen(argv));
+    }
+    if(argc < 2) {
+        stream->write_function(stream, "-USAGE: %s\n", UUID_OPENAI_ASR_SYNTAX);
+        goto out;
+    }
+
+    if((lsession = switch_core_session_locate(argv[1])) == NULL) {
+        stream->write_function(stream, "-ERR: no such session\n");
+        goto out;
+    }
+
+    if(!strcasecmp(argv[0], "start")) {
+        status = bug_start(lsession, argv[2]);
+    } else if(!strcasecmp(argv[0], "stop")) {
+        status = bug_stop(lsession);
+    } else {
+        stream->write_function(stream, "-USAGE: %s\n", UUID_OPENAI_ASR_SYNTAX);
+        goto out;
+    }
+
+    stream->write_function(stream, (status == SWITCH_STATUS_SUCCESS ? "+OK\n" : "-ERR: operation failed\n"));
+
+out:
+    if(lsession) {
+        switch_core_session_rwunlock(lsession);
+    }
+    switch_safe_free(mycmd);
+    return SWITCH_STATUS_SUCCESS;
+}
+
 // ---------------------------------------------------------------------------------------------------------------------------------------------
 // main
 // ---------------------------------------------------------------------------------------------------------------------------------------------
@@ -739,9 +2012,26 @@ SWITCH_MODULE_LOAD_FUNCTION(mod_openai_asr_load) {
     switch_status_t status = SWITCH_STATUS_SUCCESS;
     switch_xml_t cfg, xml, settings, param;
     switch_asr_interface_t *asr_interface;
+    switch_api_interface_t *commands_interface;
+    uint32_t i = 0;
 
     memset(&globals, 0, sizeof(globals));
     switch_mutex_init(&globals.mutex, SWITCH_MUTEX_NESTED, pool);
+    switch_thread_cond_create(&globals.cond, pool);
+
+    globals.fl_lang_detect = SWITCH_TRUE;
+    globals.lang_detect_threshold = DEF_LANG_DETECT_THRESHOLD;
+    globals.fl_g711_native = SWITCH_TRUE;
+    globals.hedge_min_ms = DEF_HEDGE_MIN_MS;
+    globals.retry_attempts = DEF_RETRY_ATTEMPTS;
+    globals.retry_delay_ms = DEF_RETRY_DELAY_MS;
+    globals.breaker_failures = DEF_BREAKER_FAILURES;
+    globals.breaker_open_ms = DEF_BREAKER_OPEN_MS;
+    globals.ratelimit_headroom = DEF_RATELIMIT_HEADROOM;
+    globals.ratelimit_max_wait = DEF_RATELIMIT_MAX_WAIT;
+    globals.endpoint_min_ms = DEF_ENDPOINT_MIN_MS;
+    globals.endpoint_max_ms = DEF_ENDPOINT_MAX_MS;
+    globals.mock_latency_ms = DEF_MOCK_LATENCY_MS;
 
     if((xml = switch_xml_open_cfg(MOD_CONFIG_NAME, &cfg, NULL)) == NULL) {
         switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "Unable to open configuration: %s\n", MOD_CONFIG_NAME);
@@ -762,9 +2052,60 @@ SWITCH_MODULE_LOAD_FUNCTION(mod_openai_asr_load) {
             } else if(!strcasecmp(var, "vad-debug")) {
                 if(val) globals.fl_vad_debug = switch_true(val);
             } else if(!strcasecmp(var, "api-key")) {
-                if(val) globals.api_key = switch_core_strdup(pool, val);
+                if(val) {
+                    val = switch_core_strdup(pool, val);
+                    if(apikey_add(&globals, val) == SWITCH_STATUS_SUCCESS && !globals.api_key) { globals.api_key = val; }
+                }
+            } else if(!strcasecmp(var, "ratelimit-rpm")) {
+                if(val) globals.ratelimit_rpm = atoi(val);
+            } else if(!strcasecmp(var, "ratelimit-audio-spm")) {
+                if(val) globals.ratelimit_audio_spm = atoi(val);
+            } else if(!strcasecmp(var, "ratelimit-headroom")) {
+                if(val) globals.ratelimit_headroom = atoi(val);
+            } else if(!strcasecmp(var, "ratelimit-max-wait")) {
+                if(val) globals.ratelimit_max_wait = atoi(val);
             } else if(!strcasecmp(var, "api-url")) {
-                if(val) globals.api_url = switch_core_strdup(pool, val);
+                if(val) {
+                    val = switch_core_strdup(pool, val);
+                    if(endpoint_add(&globals, pool, val) == SWITCH_STATUS_SUCCESS && !globals.api_url) { globals.api_url = val; }
+                }
+            } else if(!strcasecmp(var, "backend")) {
+                if(val && !(globals.backend = backend_lookup(val))) {
+                    switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "Unknown backend: %s\n", val);
+                    switch_goto_status(SWITCH_STATUS_GENERR, out);
+                }
+            } else if(!strcasecmp(var, "whisper-model")) {
+                if(val) globals.whisper_model = switch_core_strdup(pool, val);
+            } else if(!strcasecmp(var, "whisper-workers")) {
+                if(val) globals.whisper_workers = atoi(val);
+            } else if(!strcasecmp(var, "whisper-threads")) {
+                if(val) globals.whisper_threads = atoi(val);
+            } else if(!strcasecmp(var, "local-socket")) {
+                if(val) globals.local_socket = switch_core_strdup(pool, val);
+            } else if(!strcasecmp(var, "mock-latency-ms")) {
+                if(val) globals.mock_latency_ms = atoi(val);
+            } else if(!strcasecmp(var, "capture")) {
+                if(val) globals.fl_capture = switch_true(val);
+            } else if(!strcasecmp(var, "capture-path")) {
+                if(val) globals.capture_path = switch_core_strdup(pool, val);
+            } else if(!strcasecmp(var, "realtime-url")) {
+                if(val) globals.realtime_url = switch_core_strdup(pool, val);
+            } else if(!strcasecmp(var, "g711-native")) {
+                if(val) globals.fl_g711_native = switch_true(val);
+            } else if(!strcasecmp(var, "g711-upload")) {
+                if(val) globals.fl_g711_upload = switch_true(val);
+            } else if(!strcasecmp(var, "hedge-percentile")) {
+                if(val) globals.hedge_percentile = atoi(val);
+            } else if(!strcasecmp(var, "hedge-min-ms")) {
+                if(val) globals.hedge_min_ms = atoi(val);
+            } else if(!strcasecmp(var, "retry-attempts")) {
+                if(val) globals.retry_attempts = atoi(val);
+            } else if(!strcasecmp(var, "retry-delay-ms")) {
+                if(val) globals.retry_delay_ms = atoi(val);
+            } else if(!strcasecmp(var, "breaker-failures")) {
+                if(val) globals.breaker_failures = atoi(val);
+            } else if(!strcasecmp(var, "breaker-open-ms")) {
+                if(val) globals.breaker_open_ms = atoi(val);
             } else if(!strcasecmp(var, "user-agent")) {
                 if(val) globals.user_agent = switch_core_strdup(pool, val);
             } else if(!strcasecmp(var, "proxy")) {
@@ -775,30 +2116,63 @@ SWITCH_MODULE_LOAD_FUNCTION(mod_openai_asr_load) {
                 if(val) globals.opt_encoding = switch_core_strdup(pool, val);
             } else if(!strcasecmp(var, "model")) {
                 if(val) globals.opt_model= switch_core_strdup(pool, val);
+            } else if(!strcasecmp(var, "language")) {
+                if(val) globals.opt_lang = switch_core_strdup(pool, val);
+            } else if(!strcasecmp(var, "language-detect")) {
+                if(val) globals.fl_lang_detect = switch_true(val);
+            } else if(!strcasecmp(var, "language-detect-threshold")) {
+                if(val) globals.lang_detect_threshold = atof(val);
             } else if(!strcasecmp(var, "sentence-max-sec")) {
                 if(val) globals.sentence_max_sec = atoi(val);
             } else if(!strcasecmp(var, "sentence-threshold-sec")) {
                 if(val) globals.sentence_threshold_sec = atoi(val);
+            } else if(!strcasecmp(var, "speculative-upload")) {
+                if(val) globals.fl_speculative = switch_true(val);
+            } else if(!strcasecmp(var, "endpoint-adaptive")) {
+                if(val) globals.fl_endpoint_adaptive = switch_true(val);
+            } else if(!strcasecmp(var, "endpoint-min-ms")) {
+                if(val) globals.endpoint_min_ms = atoi(val);
+            } else if(!strcasecmp(var, "endpoint-max-ms")) {
+                if(val) globals.endpoint_max_ms = atoi(val);
             } else if(!strcasecmp(var, "request-timeout")) {
                 if(val) globals.request_timeout = atoi(val);
             } else if(!strcasecmp(var, "connect-timeout")) {
                 if(val) globals.connect_timeout = atoi(val);
             } else if(!strcasecmp(var, "log-http-errors")) {
                 if(val) globals.fl_log_http_errors = switch_true(val);
+            } else if(!strcasecmp(var, "tls-verify")) {
+                if(val) globals.fl_tls_verify = switch_true(val);
             }
         }
     }
 
-    if(!globals.api_url) {
-        switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "Missing required parameter: api-url\n");
-        switch_goto_status(SWITCH_STATUS_GENERR, out);
+    globals.backend = (globals.backend ? globals.backend : &backend_http);
+
+    if(globals.backend == &backend_http) {
+        if(!globals.api_url) {
+            switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "Missing required parameter: api-url\n");
+            switch_goto_status(SWITCH_STATUS_GENERR, out);
+        }
+        if(!globals.api_key) {
+            switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "Missing required parameter: api-key\n");
+            switch_goto_status(SWITCH_STATUS_GENERR, out);
+        }
     }
-    if(!globals.api_key) {
-        switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "Missing required parameter: api-key\n");
-        switch_goto_status(SWITCH_STATUS_GENERR, out);
+
+    for(i = 0; backends[i]; i++) {
+        if(backends[i]->load && backends[i]->load(&globals, pool) != SWITCH_STATUS_SUCCESS && backends[i] == globals.backend) {
+            switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "Unable to load backend: %s\n", backends[i]->name);
+            switch_goto_status(SWITCH_STATUS_GENERR, out);
+        }
     }
 
     globals.opt_encoding = globals.opt_encoding ?  globals.opt_encoding : "wav";
+    globals.breaker_failures = MAX(globals.breaker_failures, 1);
+    globals.endpoint_max_ms = MAX(globals.endpoint_max_ms, globals.endpoint_min_ms);
+    globals.ratelimit_headroom = (globals.ratelimit_headroom > 0 && globals.ratelimit_headroom <= 100 ? globals.ratelimit_headroom : DEF_RATELIMIT_HEADROOM);
+
+    apikey_init(&globals);
+    g711_init();
     globals.sentence_max_sec = globals.sentence_max_sec > DEF_SENTENCE_MAX_TIME ? globals.sentence_max_sec : DEF_SENTENCE_MAX_TIME;
 
     globals.tmp_path = switch_core_sprintf(pool, "%s%sopenai-asr-cache", SWITCH_GLOBAL_dirs.temp_dir, SWITCH_PATH_SEPARATOR);
@@ -806,6 +2180,10 @@ SWITCH_MODULE_LOAD_FUNCTION(mod_openai_asr_load) {
         switch_dir_make(globals.tmp_path, SWITCH_FPROT_OS_DEFAULT, NULL);
     }
 
+    if(!globals.capture_path) {
+        globals.capture_path = switch_core_sprintf(pool, "%s%sopenai-asr-capture", SWITCH_GLOBAL_dirs.recordings_dir, SWITCH_PATH_SEPARATOR);
+    }
+
     *module_interface = switch_loadable_module_create_module_interface(pool, modname);
     asr_interface = switch_loadable_module_create_interface(*module_interface, SWITCH_ASR_INTERFACE);
     asr_interface->interface_name = "openai";
@@ -823,6 +2201,14 @@ SWITCH_MODULE_LOAD_FUNCTION(mod_openai_asr_load) {
     asr_interface->asr_load_grammar = asr_load_grammar;
     asr_interface->asr_unload_grammar = asr_unload_grammar;
 
+    SWITCH_ADD_API(commands_interface, "openai_asr_bench", "compare the backends on the same audio", openai_asr_bench_function, OPENAI_ASR_BENCH_SYNTAX);
+    SWITCH_ADD_API(commands_interface, "openai_asr_replay", "replay a session capture against a backend", openai_asr_replay_function, OPENAI_ASR_REPLAY_SYNTAX);
+    SWITCH_ADD_API(commands_interface, "uuid_openai_asr", "openai dual-leg transcription", uuid_openai_asr_function, UUID_OPENAI_ASR_SYNTAX);
+
+    if(switch_event_reserve_subclass(RESULT_EVENT) != SWITCH_STATUS_SUCCESS) {
+        switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "Couldn't register subclass: %s\n", RESULT_EVENT);
+    }
+
     switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_NOTICE, "OpenAI-ASR (%s)\n", MOD_VERSION);
 out:
     if(xml) {
@@ -832,23 +2218,32 @@ out:
 }
 
 SWITCH_MODULE_SHUTDOWN_FUNCTION(mod_openai_asr_shutdown) {
-    uint8_t fl_wloop = SWITCH_TRUE;
+    uint32_t i = 0;
 
     globals.fl_shutdown = SWITCH_TRUE;
-        
+
+    for(i = 0; backends[i]; i++) {
+        if(backends[i]->wakeup) {
+            backends[i]->wakeup(NULL);
+        }
+    }
+
     switch_mutex_lock(globals.mutex);
-    fl_wloop = (globals.active_threads > 0);
+    if(globals.active_threads > 0) {
+        switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_DEBUG, "Waiting for termination (%d) threads...\n", globals.active_threads);
+        while(globals.active_threads > 0) {
+            switch_thread_cond_timedwait(globals.cond, globals.mutex, 100000);
+        }
+    }
     switch_mutex_unlock(globals.mutex);
 
+    /* the workers fire the events till the very end */
     switch_event_free_subclass(VAD_EVENT);
+    switch_event_free_subclass(RESULT_EVENT);
 
-    if(fl_wloop) {
-        switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_DEBUG, "Waiting for termination (%d) threads...\n", globals.active_threads);
-        while(fl_wloop) {
-            switch_mutex_lock(globals.mutex);
-            fl_wloop = (globals.active_threads > 0);
-            switch_mutex_unlock(globals.mutex);
-            switch_yield(100000);
+    for(i = 0; backends[i]; i++) {
+        if(backends[i]->unload) {
+            backends[i]->unload(&globals);
         }
     }
 
@@ -35,22 +35,173 @@
 #define VAD_STORE_FRAMES        64
 #define VAD_RECOVERY_FRAMES     20
 #define DEF_SENTENCE_MAX_TIME   15
+#define DEF_LANG_DETECT_THRESHOLD 0.5
+#define LANG_DETECT_ATTEMPTS    3
+#define ENDPOINTS_MAX           8
+#define LATENCY_WINDOW          128
+#define LATENCY_MIN_SAMPLES     16
+#define DEF_HEDGE_MIN_MS        500
+#define DEF_RETRY_ATTEMPTS      2
+#define DEF_RETRY_DELAY_MS      200
+#define DEF_BREAKER_FAILURES    5
+#define DEF_BREAKER_OPEN_MS     10000
+#define API_KEYS_MAX            16
+#define DEF_RATELIMIT_HEADROOM  90
+#define DEF_RATELIMIT_MAX_WAIT  60
+#define DEF_ENDPOINT_MIN_MS      300
+#define DEF_ENDPOINT_MAX_MS     3000
+#define DEF_UNIX_REQUEST_PATH   "/v1/audio/transcriptions"
+#define DEF_REALTIME_URL        "wss://api.openai.com/v1/realtime?intent=transcription"
+#define DEF_MOCK_LATENCY_MS     300
+#define CAPTURE_FILE_EXT        "oacap"
+#define RESPONSE_DEPTH_MAX      16
+#define RESPONSE_TEXT_MAX       (1024 * 1024)
+#define RESPONSE_HEAD_MAX       512
+
+typedef enum {
+    EP_STATE_CLOSED = 0,
+    EP_STATE_OPEN,
+    EP_STATE_HALF_OPEN
+} endpoint_state_t;
+
+typedef enum {
+    EP_RESULT_SUCCESS = 0,
+    EP_RESULT_FAILURE,
+    EP_RESULT_CANCELLED
+} endpoint_result_t;
+
+typedef struct asr_backend_s asr_backend_t;
+typedef struct capture_s capture_t;
+
+typedef enum {
+    ASR_CODEC_NONE = 0,
+    ASR_CODEC_L16,
+    ASR_CODEC_PCMU,
+    ASR_CODEC_PCMA
+} asr_codec_t;
+
+#define ASR_SAMPLE_BYTES(ctx)   ((ctx)->codec == ASR_CODEC_L16 ? sizeof(int16_t) : sizeof(uint8_t))
+
+typedef struct {
+    const char              *key;
+    double                  req_tokens;
+    double                  req_capacity;
+    double                  req_rate;           // per second
+    double                  audio_tokens;       // seconds
+    double                  audio_capacity;
+    double                  audio_rate;
+    switch_time_t           refilled;
+    switch_time_t           blocked_until;
+    uint32_t                rpm;
+} api_key_t;
+
+typedef struct {
+    int64_t                 retry_after_ms;     // -1 when not present
+    int64_t                 limit_requests;
+    int64_t                 remaining_requests;
+    int64_t                 reset_requests_ms;
+    int64_t                 limit_tokens;
+    int64_t                 remaining_tokens;
+    int64_t                 reset_tokens_ms;
+} ratelimit_info_t;
+
+typedef struct {
+    const char              *url;
+    const char              *socket_path;       // unix domain socket, NULL - tcp
+    endpoint_state_t        state;
+    switch_time_t           open_until;
+    uint32_t                failures;           // consecutive
+    uint8_t                 fl_probe;           // half-open probe is in flight
+} endpoint_t;
+/* what's taken from a transcription response while it arrives, the rest is skipped */
+typedef struct {
+    char                    *text;              // NUL-terminated, response_detach_text() hands it over to the consumer
+    uint32_t                text_len;
+    uint32_t                text_size;
+    char                    language[32];
+    char                    error[256];         // error.message (or error itself when it's a string)
+    char                    head[RESPONSE_HEAD_MAX + 1]; // the beginning of the body, for the logs
+    uint32_t                head_len;
+    double                  language_probability;
+    double                  logprob_sum;        // of segments[].avg_logprob
+    uint32_t                segments;
+    uint8_t                 fl_text;
+    uint8_t                 fl_error;
+    uint8_t                 fl_language_probability;
+    uint8_t                 fl_invalid;
+    /* parser state */
+    struct {
+        uint8_t             type;
+        uint8_t             field;
+    } stack[RESPONSE_DEPTH_MAX];
+    uint32_t                depth;
+    uint32_t                ucs;
+    uint32_t                surrogate;
+    uint32_t                key_len;
+    uint32_t                lit_len;
+    uint8_t                 state;
+    uint8_t                 sink;
+    uint8_t                 esc;
+    char                    key[24];
+    char                    lit[32];
+} response_t;
+
 #define VAD_EVENT "asr::vad"
 
+/* the speculative request runs on the leg's own thread, next to the worker, with its own responses and multi handle */
+#define LEG_RESPONSES(asr_ctx, leg)  (((leg) && (leg)->fl_speculating) ? (leg)->spec_responses : (asr_ctx)->responses)
+#define LEG_CURL_MULTI(asr_ctx, leg) (((leg) && (leg)->fl_speculating) ? (leg)->spec_multi : (asr_ctx)->curl_multi)
+#define RESULT_EVENT            "openai_asr::result"
+#define BUG_NAME                "openai_asr"
+#define ASR_LEGS_MAX            2
+
 typedef struct {
     switch_mutex_t          *mutex;
+    switch_thread_cond_t    *cond;              // signaled when a worker exits
+    endpoint_t              endpoints[ENDPOINTS_MAX];
+    api_key_t               api_keys[API_KEYS_MAX];
+    uint32_t                latency_ms[LATENCY_WINDOW];
+    uint32_t                latency_pos;
+    uint32_t                latency_count;
+    uint32_t                endpoints_count;
+    uint32_t                api_keys_count;
+    uint32_t                api_keys_pos;
+    uint32_t                ratelimit_rpm;      // requests per minute per key (0 - learn from the service)
+    uint32_t                ratelimit_audio_spm;// audio seconds per minute per key (0 - unlimited)
+    uint32_t                ratelimit_headroom; // percent of the limits to use
+    uint32_t                ratelimit_max_wait; // seconds
+    uint32_t                hedge_percentile;   // 0 - disabled
+    uint32_t                hedge_min_ms;
+    uint32_t                retry_attempts;
+    uint32_t                retry_delay_ms;
+    uint32_t                breaker_failures;
+    uint32_t                breaker_open_ms;
+    uint32_t                whisper_workers;
+    uint32_t                whisper_threads;    // per inference
     uint32_t                active_threads;
     uint32_t                sentence_max_sec;
     uint32_t                sentence_threshold_sec;
     uint32_t                vad_silence_ms;
     uint32_t                vad_voice_ms;
     uint32_t                vad_threshold;
+    uint32_t                endpoint_min_ms;
+    uint32_t                endpoint_max_ms;
+    uint32_t                mock_latency_ms;
     uint32_t                request_timeout;    // seconds
     uint32_t                connect_timeout;    // seconds
+    float                   lang_detect_threshold;
+    uint8_t                 fl_lang_detect;
+    uint8_t                 fl_endpoint_adaptive;
+    uint8_t                 fl_speculative;     // upload at STOP_TALKING, release the result at the deadline
+    uint8_t                 fl_g711_native;     // tap the native G.711 frames in the media bug
+    uint8_t                 fl_g711_upload;     // upload G.711 as is (wav, format 6/7)
     uint8_t                 fl_vad_debug;
     uint8_t                 fl_shutdown;
     uint8_t                 fl_log_http_errors;
+    uint8_t                 fl_tls_verify;
+    uint8_t                 fl_capture;         // record the fed frames for openai_asr_replay
     char                    *tmp_path;
+    const char              *capture_path;
     const char              *api_key;
     const char              *api_url;
     const char              *user_agent;
@@ -58,27 +209,81 @@ typedef struct {
     const char              *proxy_credentials;
     const char              *opt_encoding;
     const char              *opt_model;
+    const char              *opt_lang;
+    const char              *whisper_model;
+    const char              *realtime_url;
+    const char              *local_socket;
+    asr_backend_t           *backend;
 } globals_t;
 
 typedef struct {
-    switch_memory_pool_t    *pool;
+    double                  pause_mean;         // ms, of the pauses the speaker resumed after (feed side, asr_ctx->mutex)
+    double                  pause_var;
+    double                  words_per_sec;      // worker side
+    uint32_t                pauses_count;
+    uint32_t                results_count;
+    uint32_t                clock_ms;           // of the fed audio
+    uint32_t                stopped_ms;         // the last STOP_TALKING, 0 - talking
+    uint32_t                utterance_ms;       // of the last utterance sent (worker side)
+} endpointer_t;
+
+typedef struct {
+    const char              *name;
     switch_vad_t            *vad;
     switch_buffer_t         *vad_buffer;
-    switch_mutex_t          *mutex;
     switch_queue_t          *q_audio;
+    switch_buffer_t         *chunk_buffer;      // worker side
+    switch_vad_state_t      vad_state;          // written by the media thread under asr_ctx->mutex
+    switch_time_t           sentence_timeout;   // worker side
+    uint32_t                schunks;            // worker side
+    uint32_t                vad_stored_frames;
+    uint32_t                lang_detect_attempts; // worker side
+    uint32_t                streamed;           // bytes streamed in the current utterance (worker side)
+    uint32_t                spec_len;           // bytes of chunk_buffer the speculative result covers (worker side)
+    char                    *spec_text;         // the speculative result, held till the deadline (worker side)
+    switch_thread_t         *spec_thread;       // runs the speculative requests of the leg, started with the first one
+    switch_byte_t           *spec_data;         // the utterance as it was at STOP_TALKING, the chunk buffer goes on
+    uint32_t                spec_data_len;
+    uint32_t                spec_data_size;
+    CURLM                   *spec_multi;        // the speculation thread's own one (asr_ctx->mutex)
+    response_t              spec_responses[2];
+    void                    *stream;            // backend's own per-leg state, released by close() (worker side)
+    uint8_t                 fl_vad_first_cycle;
+    uint8_t                 fl_speculating;     // results go to spec_text (speculation thread while it runs)
+    uint8_t                 fl_spec_running;    // handed to the speculation thread, cleared when it's over (asr_ctx->mutex)
+    char                    lang[8];            // detected and pinned language (worker side)
+    endpointer_t            ep;
+} asr_leg_t;
+
+typedef struct {
+    switch_memory_pool_t    *pool;
+    switch_mutex_t          *mutex;
+    switch_thread_cond_t    *cond;              // wakes the worker up / signals its exit
     switch_queue_t          *q_text;
-    switch_buffer_t         *curl_recv_buffer_ref;
-    switch_vad_state_t      vad_state;
+    switch_media_bug_t      *bug;
+    response_t              responses[2];       // the request and its hedge, reused by the whole session (worker side)
+    asr_backend_t           *backend;
+    capture_t               *capture;           // opened at the first frame
+    CURLM                   *curl_multi;        // reused by the worker to keep the connections alive
+    asr_leg_t               legs[ASR_LEGS_MAX];
+    asr_codec_t             codec;              // of the fed frames and all the buffers
     int32_t                 transcription_results;
+    uint32_t                legs_count;
     uint32_t                vad_buffer_size;
-    uint32_t                vad_stored_frames;
     uint32_t                chunk_buffer_size;
     uint32_t                refs;
     uint32_t                samplerate;
     uint32_t                channels;
     uint32_t                frame_len;
+    uint32_t                endpoint_min_ms;
+    uint32_t                endpoint_max_ms;
+    uint32_t                requests;           // sent to the backend (worker side)
+    uint8_t                 fl_endpoint_adaptive;
+    uint8_t                 fl_speculative;
+    uint8_t                 fl_capture;
     uint8_t                 fl_pause;
-    uint8_t                 fl_vad_first_cycle;
+    uint8_t                 fl_lang_detect;
+    uint8_t                 fl_started;         // the worker runs, the backend is fixed
     uint8_t                 fl_destroyed;
     uint8_t                 fl_abort;
     char                    *opt_lang;
@@ -93,8 +298,121 @@ typedef struct {
     switch_byte_t           *data;
 } xdata_buffer_t;
 
+struct asr_backend_s {
+    const char              *name;
+    switch_status_t         (*load)(globals_t *globals, switch_memory_pool_t *pool);
+    void                    (*unload)(globals_t *globals);
+    switch_status_t         (*transcribe)(asr_ctx_t *asr_ctx, asr_leg_t *leg, switch_byte_t *data, uint32_t data_len, globals_t *globals);
+    void                    (*wakeup)(asr_ctx_t *asr_ctx);
+    /* streaming backends only: frames as they come (NULL - the utterance is over), results are picked up in poll() */
+    switch_status_t         (*stream)(asr_ctx_t *asr_ctx, asr_leg_t *leg, switch_byte_t *data, uint32_t data_len, globals_t *globals);
+    void                    (*poll)(asr_ctx_t *asr_ctx, globals_t *globals);
+    void                    (*close)(asr_ctx_t *asr_ctx);
+};
+
+typedef struct {
+    CURL                    *handle;
+    curl_mime               *form;
+    switch_curl_slist_t     *headers;
+    response_t              *response;
+    endpoint_t              *endpoint;
+    api_key_t               *api_key;
+    ratelimit_info_t        ratelimit;
+    switch_time_t           started;
+    switch_CURLcode         curl_ret;
+    long                    http_resp;
+    uint8_t                 fl_done;
+} http_request_t;
+
+typedef struct {
+    uint64_t                ts;                 // us since the capture has started
+    const switch_byte_t     *data;
+    uint32_t                len;
+    uint8_t                 leg;
+    uint8_t                 vad;                // switch_vad_state_t after the frame
+} capture_frame_t;
+
+typedef struct {
+    const switch_byte_t     *base;              // the mmap()ed file
+    switch_size_t           size;
+    switch_size_t           offset;             // of the next record
+    switch_size_t           end;                // of the records
+    const void              *index;             // NULL - the capture wasn't closed, no seeking
+    uint32_t                index_count;
+    uint32_t                samplerate;
+    uint32_t                legs;
+    asr_codec_t             codec;
+} capture_reader_t;
+
 /* my_curl.c */
-switch_status_t curl_perform(switch_buffer_t *recv_buffer, asr_ctx_t *asr_ctx, char *filename, globals_t *globals);
+switch_status_t curl_perform(response_t *response, asr_ctx_t *asr_ctx, asr_leg_t *leg, char *filename, double audio_sec, globals_t *globals);
+
+/* mod_openai_asr.c */
+extern asr_backend_t backend_http;
+void asr_result_push(asr_ctx_t *asr_ctx, asr_leg_t *leg, const char *text);
+void asr_result_take(asr_ctx_t *asr_ctx, asr_leg_t *leg, char *text);
+void asr_result_push_response(asr_ctx_t *asr_ctx, asr_leg_t *leg, response_t *response);
+void asr_partial_push(asr_ctx_t *asr_ctx, asr_leg_t *leg, const char *text);
+switch_bool_t speculation_stale(asr_ctx_t *asr_ctx, asr_leg_t *leg);
+
+/* backend_whisper.c */
+extern asr_backend_t backend_whisper;
+
+/* backend_local.c */
+extern asr_backend_t backend_local;
+
+/* backend_realtime.c */
+extern asr_backend_t backend_realtime;
+
+/* backend_mock.c */
+extern asr_backend_t backend_mock;
+
+/* capture.c */
+capture_t *capture_open(asr_ctx_t *asr_ctx, globals_t *globals);
+void capture_write(capture_t *cap, uint32_t leg, const void *data, uint32_t data_len, switch_vad_state_t vad_state);
+void capture_close(capture_t **cap);
+switch_status_t capture_reader_open(capture_reader_t *rd, const char *path);
+switch_bool_t capture_reader_next(capture_reader_t *rd, capture_frame_t *frame);
+void capture_reader_seek(capture_reader_t *rd, uint64_t ts);
+void capture_reader_close(capture_reader_t *rd);
+
+/* response.c */
+void response_reset(response_t *resp);
+void response_feed(response_t *resp, const char *data, size_t len);
+switch_bool_t response_complete(response_t *resp);
+char *response_detach_text(response_t *resp);
+void response_free(response_t *resp);
+
+/* endpointer.c */
+void endpointer_feed(asr_ctx_t *asr_ctx, asr_leg_t *leg, uint32_t data_len, switch_vad_state_t vad_state);
+void endpointer_result(asr_ctx_t *asr_ctx, asr_leg_t *leg, const char *text, uint32_t audio_ms);
+uint32_t endpointer_deadline(asr_ctx_t *asr_ctx, asr_leg_t *leg, globals_t *globals);
+
+/* endpoint.c */
+switch_status_t endpoint_add(globals_t *globals, switch_memory_pool_t *pool, const char *url);
+endpoint_t *endpoint_acquire(globals_t *globals, endpoint_t *exclude);
+void endpoint_report(globals_t *globals, endpoint_t *endpoint, endpoint_result_t result, uint32_t latency_ms);
+uint32_t endpoint_hedge_delay(globals_t *globals);
+
+/* ratelimit.c */
+switch_status_t apikey_add(globals_t *globals, const char *key);
+void apikey_init(globals_t *globals);
+api_key_t *apikey_acquire(globals_t *globals, double audio_sec, switch_time_t *wait);
+void apikey_update(globals_t *globals, api_key_t *key, ratelimit_info_t *info, long http_resp);
+void ratelimit_info_init(ratelimit_info_t *info);
+void ratelimit_header_parse(ratelimit_info_t *info, const char *line, size_t len);
+
+/* g711.c */
+void g711_init(void);
+asr_codec_t g711_codec_lookup(const char *name);
+const char *g711_codec_name(asr_codec_t codec);
+void g711_decode(asr_codec_t codec, const uint8_t *src, uint32_t samples, int16_t *dst);
+char *g711_chunk_write(asr_codec_t codec, switch_byte_t *buf, uint32_t buf_len, uint32_t channels, uint32_t samplerate, const char *path);
+
+/* lang.c */
+const char *lang_request_language(asr_ctx_t *asr_ctx, asr_leg_t *leg, globals_t *globals);
+switch_bool_t lang_detect_required(asr_ctx_t *asr_ctx, asr_leg_t *leg, globals_t *globals);
+void lang_detect_update(asr_ctx_t *asr_ctx, asr_leg_t *leg, response_t *resp, globals_t *globals);
 
 /* utils.c */
 char *chunk_write(switch_byte_t *buf, uint32_t buf_len, uint32_t channels, uint32_t samplerate, const char *file_ext);
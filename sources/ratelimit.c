@@ -0,0 +1,248 @@
+/*
+ * FreeSWITCH Modular Media Switching Software Library / Soft-Switch Application
+ * Copyright (C) 2005-2014, Anthony Minessale II <anthm@freeswitch.org>
+ *
+ * Version: MPL 1.1
+ *
+ * The contents of this file are subject to the Mozilla Public License Version
+ * 1.1 (the "License"); you may not use this file except in compliance with
+ * the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS" basis,
+ * WITHOUT WARRANTY OF ANY KIND, either express or implied. See the License
+ * for the specific language governing rights and limitations under the
+ * License.
+ *
+ * Module Contributor(s):
+ *  Konstantin Alexandrin <akscfx@gmail.com>
+ *
+ *
+ * ratelimit.c -- api keys rotation and pacing
+ *
+ * Every key has two token buckets: requests and audio seconds per minute,
+ * the limits come from the configuration and are corrected by the x-ratelimit-* headers.
+ * The buckets hold 1/6 of the (headroom reduced) minute quota, so the requests are spread
+ * over the minute instead of being sent in a burst that the service would reject.
+ *
+ */
+#include "mod_openai_asr.h"
+
+#define RATELIMIT_BURST_DIVIDER     6
+
+static void bucket_setup(double *capacity, double *rate, double *tokens, double per_minute, globals_t *globals) {
+    double old_capacity = *capacity;
+
+    if(per_minute <= 0) {
+        *capacity = *rate = *tokens = 0;
+        return;
+    }
+
+    *capacity = MAX((per_minute * globals->ratelimit_headroom / 100) / RATELIMIT_BURST_DIVIDER, 1);
+    *rate = (per_minute * globals->ratelimit_headroom / 100) / 60;
+    *tokens = (old_capacity > 0 ? MIN(*tokens, *capacity) : *capacity);
+}
+
+static void bucket_refill(api_key_t *key, switch_time_t now) {
+    double elapsed = (double)(now - key->refilled) / 1000000;
+
+    if(elapsed <= 0) {
+        return;
+    }
+    if(key->req_capacity > 0) {
+        key->req_tokens = MIN(key->req_tokens + (elapsed * key->req_rate), key->req_capacity);
+    }
+    if(key->audio_capacity > 0) {
+        key->audio_tokens = MIN(key->audio_tokens + (elapsed * key->audio_rate), key->audio_capacity);
+    }
+    key->refilled = now;
+}
+
+/* microseconds till the key can take the request, 0 - right now */
+static switch_time_t bucket_wait(api_key_t *key, double audio_sec, switch_time_t now) {
+    switch_time_t wait = 0;
+
+    if(key->blocked_until > now) {
+        wait = (key->blocked_until - now);
+    }
+    if(key->req_capacity > 0 && key->req_tokens < 1) {
+        wait = MAX(wait, (switch_time_t)(((1 - key->req_tokens) / key->req_rate) * 1000000));
+    }
+    if(key->audio_capacity > 0) {
+        /* an utterance longer than the bucket passes once the bucket is full */
+        double need = MIN(audio_sec, key->audio_capacity);
+        if(key->audio_tokens < need) {
+            wait = MAX(wait, (switch_time_t)(((need - key->audio_tokens) / key->audio_rate) * 1000000));
+        }
+    }
+    return wait;
+}
+
+/* "1s", "6m0s", "20ms", "1h2m3.5s" */
+static int64_t duration_parse_ms(const char *str) {
+    double total = 0, val = 0;
+    char *end = NULL;
+
+    while(str && *str) {
+        val = strtod(str, &end);
+        if(end == str) {
+            break;
+        }
+        if(!strncmp(end, "ms", 2)) {
+            total += val; end += 2;
+        } else if(*end == 'h') {
+            total += val * 3600000; end++;
+        } else if(*end == 'm') {
+            total += val * 60000; end++;
+        } else if(*end == 's') {
+            total += val * 1000; end++;
+        } else {
+            total += val * 1000;
+        }
+        str = end;
+    }
+
+    return (int64_t)total;
+}
+
+switch_status_t apikey_add(globals_t *globals, const char *key) {
+    api_key_t *api_key = NULL;
+
+    if(globals->api_keys_count >= API_KEYS_MAX) {
+        switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_WARNING, "Too many api keys, ignoring the rest\n");
+        return SWITCH_STATUS_FALSE;
+    }
+
+    api_key = &globals->api_keys[globals->api_keys_count++];
+    memset(api_key, 0, sizeof(api_key_t));
+    api_key->key = key;
+
+    return SWITCH_STATUS_SUCCESS;
+}
+
+void apikey_init(globals_t *globals) {
+    uint32_t i = 0;
+
+    for(i = 0; i < globals->api_keys_count; i++) {
+        api_key_t *key = &globals->api_keys[i];
+
+        key->rpm = globals->ratelimit_rpm;
+        bucket_setup(&key->req_capacity, &key->req_rate, &key->req_tokens, globals->ratelimit_rpm, globals);
+        bucket_setup(&key->audio_capacity, &key->audio_rate, &key->audio_tokens, globals->ratelimit_audio_spm, globals);
+        key->refilled = switch_micro_time_now();
+    }
+}
+
+/*
+ * takes the next key (round-robin) that has enough tokens,
+ * when there is no such key returns NULL and the time to wait for the earliest one
+ */
+api_key_t *apikey_acquire(globals_t *globals, double audio_sec, switch_time_t *wait) {
+    api_key_t *result = NULL;
+    switch_time_t now = switch_micro_time_now(), min_wait = 0;
+    uint32_t i = 0;
+
+    switch_mutex_lock(globals->mutex);
+    for(i = 0; i < globals->api_keys_count; i++) {
+        api_key_t *key = &globals->api_keys[(globals->api_keys_pos + i) % globals->api_keys_count];
+        switch_time_t kwait = 0;
+
+        bucket_refill(key, now);
+
+        if((kwait = bucket_wait(key, audio_sec, now)) == 0) {
+            if(key->req_capacity > 0) { key->req_tokens -= 1; }
+            if(key->audio_capacity > 0) { key->audio_tokens -= audio_sec; }
+            globals->api_keys_pos = ((globals->api_keys_pos + i + 1) % globals->api_keys_count);
+            result = key;
+            break;
+        }
+        min_wait = (min_wait == 0 ? kwait : MIN(min_wait, kwait));
+    }
+    switch_mutex_unlock(globals->mutex);
+
+    if(wait) {
+        *wait = (result ? 0 : min_wait);
+    }
+    return result;
+}
+
+void apikey_update(globals_t *globals, api_key_t *key, ratelimit_info_t *info, long http_resp) {
+    switch_time_t now = switch_micro_time_now();
+    int64_t block_ms = 0;
+
+    if(!key || !info) {
+        return;
+    }
+
+    switch_mutex_lock(globals->mutex);
+
+    if(info->limit_requests > 0 && (uint32_t)info->limit_requests != key->rpm) {
+        key->rpm = (uint32_t)info->limit_requests;
+        bucket_setup(&key->req_capacity, &key->req_rate, &key->req_tokens, info->limit_requests, globals);
+    }
+    if(info->remaining_requests >= 0 && key->req_capacity > 0) {
+        key->req_tokens = MIN(key->req_tokens, info->remaining_requests);
+    }
+    if(info->remaining_requests == 0 && info->reset_requests_ms > 0) {
+        block_ms = MAX(block_ms, info->reset_requests_ms);
+    }
+    if(info->remaining_tokens == 0 && info->reset_tokens_ms > 0) {
+        block_ms = MAX(block_ms, info->reset_tokens_ms);
+    }
+    if(http_resp == 429) {
+        block_ms = MAX(block_ms, (info->retry_after_ms > 0 ? info->retry_after_ms : MAX(info->reset_requests_ms, 1000)));
+        if(key->req_capacity > 0) { key->req_tokens = 0; }
+    }
+
+    if(block_ms > 0) {
+        key->blocked_until = MAX(key->blocked_until, now + (block_ms * 1000));
+        switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_DEBUG, "api key ...%s is paused for %d ms\n",
+            (strlen(key->key) > 4 ? key->key + strlen(key->key) - 4 : ""), (int)block_ms);
+    }
+
+    switch_mutex_unlock(globals->mutex);
+}
+
+void ratelimit_info_init(ratelimit_info_t *info) {
+    info->retry_after_ms = -1;
+    info->limit_requests = info->remaining_requests = info->reset_requests_ms = -1;
+    info->limit_tokens = info->remaining_tokens = info->reset_tokens_ms = -1;
+}
+
+void ratelimit_header_parse(ratelimit_info_t *info, const char *line, size_t len) {
+    char name[64] = { 0 }, value[64] = { 0 };
+    const char *colon = memchr(line, ':', len);
+    size_t nlen = 0, vlen = 0;
+    const char *vstart = NULL;
+
+    if(!colon || (nlen = (colon - line)) >= sizeof(name)) {
+        return;
+    }
+    memcpy(name, line, nlen);
+
+    for(vstart = colon + 1; vstart < line + len && (*vstart == ' ' || *vstart == '\t'); vstart++);
+    for(vlen = (line + len) - vstart; vlen > 0 && (vstart[vlen - 1] == '\r' || vstart[vlen - 1] == '\n' || vstart[vlen - 1] == ' '); vlen--);
+    if(vlen == 0 || vlen >= sizeof(value)) {
+        return;
+    }
+    memcpy(value, vstart, vlen);
+
+    if(!strcasecmp(name, "retry-after")) {
+        /* delay-seconds only, http-date isn't used by the services */
+        info->retry_after_ms = (int64_t)(atof(value) * 1000);
+    } else if(!strcasecmp(name, "retry-after-ms")) {
+        info->retry_after_ms = atoll(value);
+    } else if(!strcasecmp(name, "x-ratelimit-limit-requests")) {
+        info->limit_requests = atoll(value);
+    } else if(!strcasecmp(name, "x-ratelimit-remaining-requests")) {
+        info->remaining_requests = atoll(value);
+    } else if(!strcasecmp(name, "x-ratelimit-reset-requests")) {
+        info->reset_requests_ms = duration_parse_ms(value);
+    } else if(!strcasecmp(name, "x-ratelimit-limit-tokens")) {
+        info->limit_tokens = atoll(value);
+    } else if(!strcasecmp(name, "x-ratelimit-remaining-tokens")) {
+        info->remaining_tokens = atoll(value);
+    } else if(!strcasecmp(name, "x-ratelimit-reset-tokens")) {
+        info->reset_tokens_ms = duration_parse_ms(value);
+    }
+}
@@ -0,0 +1,523 @@
+/*
+ * FreeSWITCH Modular Media Switching Software Library / Soft-Switch Application
+ * Copyright (C) 2005-2014, Anthony Minessale II <anthm@freeswitch.org>
+ *
+ * Version: MPL 1.1
+ *
+ * The contents of this file are subject to the Mozilla Public License Version
+ * 1.1 (the "License"); you may not use this file except in compliance with
+ * the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS" basis,
+ * WITHOUT WARRANTY OF ANY KIND, either express or implied. See the License
+ * for the specific language governing rights and limitations under the
+ * License.
+ *
+ * Module Contributor(s):
+ *  Konstantin Alexandrin <akscfx@gmail.com>
+ *
+ *
+ * response.c -- incremental extraction of the transcription responses
+ *
+ * The body is fed as curl delivers it and nothing is kept but what the module uses:
+ *  text, language, language_probability, error (error.message) and segments[].avg_logprob (verbose_json).
+ * Nested fields with the same names (segments[].text and so on) are skipped, as is everything else.
+ * A delivered text is handed over with response_detach_text() and the consumer frees it,
+ * each result is a fresh allocation and the next response grows a new buffer.
+ *
+ */
+#include "mod_openai_asr.h"
+
+enum {
+    RS_VALUE = 0,
+    RS_OBJECT_FIRST,                            // after '{'
+    RS_ARRAY_FIRST,                             // after '['
+    RS_KEY,
+    RS_COLON,
+    RS_NEXT,                                    // after a value
+    RS_STRING,
+    RS_LITERAL,                                 // number, true, false, null
+    RS_DONE
+};
+
+enum {
+    CT_OBJECT = 1,
+    CT_ARRAY
+};
+
+enum {
+    F_NONE = 0,
+    F_TEXT,
+    F_LANGUAGE,
+    F_LANG_PROB,
+    F_ERROR,
+    F_MESSAGE,
+    F_SEGMENTS,
+    F_AVG_LOGPROB
+};
+
+enum {
+    SK_NONE = 0,
+    SK_KEY,
+    SK_TEXT,
+    SK_LANGUAGE,
+    SK_LANG_PROB,
+    SK_ERROR,
+    SK_LOGPROB
+};
+
+static const struct {
+    const char *name;
+    uint8_t     field;
+} response_fields[] = {
+    { "text", F_TEXT },
+    { "language", F_LANGUAGE },
+    { "language_probability", F_LANG_PROB },
+    { "error", F_ERROR },
+    { "message", F_MESSAGE },
+    { "segments", F_SEGMENTS },
+    { "avg_logprob", F_AVG_LOGPROB },
+    { NULL, F_NONE }
+};
+
+static void response_fail(response_t *resp) {
+    resp->fl_invalid = SWITCH_TRUE;
+}
+
+/* what the value that starts now is for */
+static uint8_t response_value_sink(response_t *resp) {
+    if(resp->depth == 0 || resp->stack[0].type != CT_OBJECT) {
+        return SK_NONE;
+    }
+    if(resp->depth == 1) {
+        switch(resp->stack[0].field) {
+            case F_TEXT:        return SK_TEXT;
+            case F_LANGUAGE:    return SK_LANGUAGE;
+            case F_LANG_PROB:   return SK_LANG_PROB;
+            case F_ERROR:       return SK_ERROR;
+            default:            return SK_NONE;
+        }
+    }
+    if(resp->depth == 2 && resp->stack[0].field == F_ERROR && resp->stack[1].type == CT_OBJECT && resp->stack[1].field == F_MESSAGE) {
+        return SK_ERROR;
+    }
+    if(resp->depth == 3 && resp->stack[0].field == F_SEGMENTS && resp->stack[1].type == CT_ARRAY && resp->stack[2].type == CT_OBJECT && resp->stack[2].field == F_AVG_LOGPROB) {
+        return SK_LOGPROB;
+    }
+    return SK_NONE;
+}
+
+static void response_text_put(response_t *resp, const char *data, uint32_t len) {
+    uint32_t need = resp->text_len + len + 1;
+
+    if(need > resp->text_size) {
+        uint32_t size = MAX(need, MAX(resp->text_size * 2, 256));
+        char *text = NULL;
+
+        if(need > RESPONSE_TEXT_MAX || (text = realloc(resp->text, size)) == NULL) {
+            response_fail(resp);
+            return;
+        }
+        resp->text = text;
+        resp->text_size = size;
+    }
+    memcpy(resp->text + resp->text_len, data, len);
+    resp->text_len += len;
+    resp->text[resp->text_len] = '\0';
+}
+
+static void response_fixed_put(char *buf, switch_size_t size, const char *data, uint32_t len) {
+    switch_size_t pos = strlen(buf);
+
+    len = MIN(len, size - pos - 1);
+    memcpy(buf + pos, data, len);
+    buf[pos + len] = '\0';
+}
+
+static void response_put(response_t *resp, const char *data, uint32_t len) {
+    switch(resp->sink) {
+        case SK_KEY:
+            if(resp->key_len + len < sizeof(resp->key)) {
+                memcpy(resp->key + resp->key_len, data, len);
+                resp->key_len += len;
+            } else {
+                resp->key_len = sizeof(resp->key); // too long for any of the fields
+            }
+            break;
+        case SK_TEXT:
+            response_text_put(resp, data, len);
+            break;
+        case SK_LANGUAGE:
+            response_fixed_put(resp->language, sizeof(resp->language), data, len);
+            break;
+        case SK_ERROR:
+            response_fixed_put(resp->error, sizeof(resp->error), data, len);
+            break;
+        default:
+            break;
+    }
+}
+
+static void response_put_ucs(response_t *resp, uint32_t cp) {
+    char utf8[4];
+    uint32_t len = 0;
+
+    if(cp < 0x80) {
+        utf8[len++] = cp;
+    } else if(cp < 0x800) {
+        utf8[len++] = 0xC0 | (cp >> 6);
+        utf8[len++] = 0x80 | (cp & 0x3F);
+    } else if(cp < 0x10000) {
+        utf8[len++] = 0xE0 | (cp >> 12);
+        utf8[len++] = 0x80 | ((cp >> 6) & 0x3F);
+        utf8[len++] = 0x80 | (cp & 0x3F);
+    } else {
+        utf8[len++] = 0xF0 | (cp >> 18);
+        utf8[len++] = 0x80 | ((cp >> 12) & 0x3F);
+        utf8[len++] = 0x80 | ((cp >> 6) & 0x3F);
+        utf8[len++] = 0x80 | (cp & 0x3F);
+    }
+    response_put(resp, utf8, len);
+}
+
+/* a high surrogate that didn't get its pair */
+static void response_surrogate_flush(response_t *resp) {
+    if(resp->surrogate) {
+        resp->surrogate = 0;
+        response_put_ucs(resp, 0xFFFD);
+    }
+}
+
+static void response_escaped_ucs(response_t *resp, uint32_t cp) {
+    if(cp >= 0xD800 && cp <= 0xDBFF) {
+        response_surrogate_flush(resp);
+        resp->surrogate = cp;
+        return;
+    }
+    if(cp >= 0xDC00 && cp <= 0xDFFF) {
+        cp = (resp->surrogate ? 0x10000 + ((resp->surrogate - 0xD800) << 10) + (cp - 0xDC00) : 0xFFFD);
+        resp->surrogate = 0;
+    } else {
+        response_surrogate_flush(resp);
+    }
+    response_put_ucs(resp, cp);
+}
+
+static void response_value_end(response_t *resp) {
+    resp->sink = SK_NONE;
+    resp->state = (resp->depth ? RS_NEXT : RS_DONE);
+}
+
+static void response_string_end(response_t *resp) {
+    uint32_t i = 0;
+
+    response_surrogate_flush(resp);
+
+    if(resp->sink != SK_KEY) {
+        response_value_end(resp);
+        return;
+    }
+
+    resp->stack[resp->depth - 1].field = F_NONE;
+    if(resp->key_len < sizeof(resp->key)) {
+        resp->key[resp->key_len] = '\0';
+        for(i = 0; response_fields[i].name; i++) {
+            if(!strcmp(resp->key, response_fields[i].name)) {
+                resp->stack[resp->depth - 1].field = response_fields[i].field;
+                break;
+            }
+        }
+    }
+    resp->sink = SK_NONE;
+    resp->state = RS_COLON;
+}
+
+static void response_string_char(response_t *resp, uint8_t c) {
+    char ch = c;
+
+    if(resp->esc == 0) {
+        if(c == '"') {
+            response_string_end(resp);
+        } else if(c == '\\') {
+            resp->esc = 1;
+        } else if(c < 0x20) {
+            response_fail(resp);
+        } else {
+            response_surrogate_flush(resp);
+            response_put(resp, &ch, 1);
+        }
+        return;
+    }
+
+    if(resp->esc == 1) {
+        resp->esc = 0;
+        switch(c) {
+            case '"': case '\\': case '/': break;
+            case 'b': ch = '\b'; break;
+            case 'f': ch = '\f'; break;
+            case 'n': ch = '\n'; break;
+            case 'r': ch = '\r'; break;
+            case 't': ch = '\t'; break;
+            case 'u':
+                resp->esc = 2;
+                resp->ucs = 0;
+                return;
+            default:
+                response_fail(resp);
+                return;
+        }
+        response_surrogate_flush(resp);
+        response_put(resp, &ch, 1);
+        return;
+    }
+
+    /* \uXXXX, esc counts the digits from 2 */
+    if(c >= '0' && c <= '9') {
+        resp->ucs = (resp->ucs << 4) | (c - '0');
+    } else if((c | 0x20) >= 'a' && (c | 0x20) <= 'f') {
+        resp->ucs = (resp->ucs << 4) | ((c | 0x20) - 'a' + 10);
+    } else {
+        response_fail(resp);
+        return;
+    }
+    if(++resp->esc == 6) {
+        resp->esc = 0;
+        response_escaped_ucs(resp, resp->ucs);
+    }
+}
+
+static void response_literal_end(response_t *resp) {
+    char *end = NULL;
+    double val = 0;
+
+    resp->lit[resp->lit_len] = '\0';
+
+    if(!strcmp(resp->lit, "null") || !strcmp(resp->lit, "false")) {
+        response_value_end(resp);
+        return;
+    }
+    if(!strcmp(resp->lit, "true")) {
+        if(resp->sink == SK_ERROR) { resp->fl_error = SWITCH_TRUE; }
+        response_value_end(resp);
+        return;
+    }
+
+    val = strtod(resp->lit, &end);
+    if(end == resp->lit || *end != '\0') {
+        response_fail(resp);
+        return;
+    }
+    switch(resp->sink) {
+        case SK_LANG_PROB:
+            resp->language_probability = val;
+            resp->fl_language_probability = SWITCH_TRUE;
+            break;
+        case SK_LOGPROB:
+            resp->logprob_sum += val;
+            resp->segments++;
+            break;
+        case SK_ERROR:
+            resp->fl_error = SWITCH_TRUE;
+            break;
+        default:
+            break;
+    }
+    response_value_end(resp);
+}
+
+static void response_value_start(response_t *resp, uint8_t c) {
+    uint8_t sink = response_value_sink(resp);
+
+    if(c == '{' || c == '[') {
+        if(resp->depth >= RESPONSE_DEPTH_MAX) {
+            response_fail(resp);
+            return;
+        }
+        if(sink == SK_ERROR) {
+            resp->fl_error = SWITCH_TRUE;
+        }
+        resp->stack[resp->depth].type = (c == '{' ? CT_OBJECT : CT_ARRAY);
+        resp->stack[resp->depth].field = F_NONE;
+        resp->depth++;
+        resp->state = (c == '{' ? RS_OBJECT_FIRST : RS_ARRAY_FIRST);
+        return;
+    }
+
+    if(c == '"') {
+        switch(sink) {
+            case SK_TEXT:
+                resp->text_len = 0;
+                resp->fl_text = SWITCH_TRUE;
+                response_text_put(resp, "", 0);
+                break;
+            case SK_LANGUAGE:
+                resp->language[0] = '\0';
+                break;
+            case SK_ERROR:
+                resp->fl_error = SWITCH_TRUE;
+                resp->error[0] = '\0';
+                break;
+            default:
+                sink = SK_NONE;
+                break;
+        }
+        resp->sink = sink;
+        resp->esc = 0;
+        resp->surrogate = 0;
+        resp->state = RS_STRING;
+        return;
+    }
+
+    if(c == '-' || (c >= '0' && c <= '9') || (c >= 'a' && c <= 'z')) {
+        resp->sink = sink;
+        resp->lit[0] = c;
+        resp->lit_len = 1;
+        resp->state = RS_LITERAL;
+        return;
+    }
+
+    response_fail(resp);
+}
+
+/* returns FALSE when the character ends a literal and has to be looked at once more */
+static switch_bool_t response_step(response_t *resp, uint8_t c) {
+    if(resp->state == RS_STRING) {
+        response_string_char(resp, c);
+        return SWITCH_TRUE;
+    }
+    if(resp->state == RS_LITERAL) {
+        if(c == '-' || c == '+' || c == '.' || (c >= '0' && c <= '9') || (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z')) {
+            if(resp->lit_len + 1 >= sizeof(resp->lit)) {
+                response_fail(resp);
+            } else {
+                resp->lit[resp->lit_len++] = c;
+            }
+            return SWITCH_TRUE;
+        }
+        response_literal_end(resp);
+        return SWITCH_FALSE;
+    }
+
+    if(c == ' ' || c == '\t' || c == '\r' || c == '\n') {
+        return SWITCH_TRUE;
+    }
+
+    switch(resp->state) {
+        case RS_VALUE:
+            response_value_start(resp, c);
+            break;
+
+        case RS_ARRAY_FIRST:
+            if(c == ']') {
+                resp->depth--;
+                response_value_end(resp);
+            } else {
+                response_value_start(resp, c);
+            }
+            break;
+
+        case RS_OBJECT_FIRST:
+            if(c == '}') {
+                resp->depth--;
+                response_value_end(resp);
+                break;
+            }
+            /* fall through */
+        case RS_KEY:
+            if(c == '"') {
+                resp->sink = SK_KEY;
+                resp->key_len = 0;
+                resp->esc = 0;
+                resp->surrogate = 0;
+                resp->state = RS_STRING;
+            } else {
+                response_fail(resp);
+            }
+            break;
+
+        case RS_COLON:
+            if(c == ':') {
+                resp->state = RS_VALUE;
+            } else {
+                response_fail(resp);
+            }
+            break;
+
+        case RS_NEXT: {
+            uint8_t type = resp->stack[resp->depth - 1].type;
+
+            if(c == ',') {
+                resp->state = (type == CT_OBJECT ? RS_KEY : RS_VALUE);
+            } else if((c == '}' && type == CT_OBJECT) || (c == ']' && type == CT_ARRAY)) {
+                resp->depth--;
+                response_value_end(resp);
+            } else {
+                response_fail(resp);
+            }
+            break;
+        }
+
+        default:
+            /* anything after the value */
+            response_fail(resp);
+            break;
+    }
+
+    return SWITCH_TRUE;
+}
+
+void response_reset(response_t *resp) {
+    char *text = resp->text;
+    uint32_t text_size = resp->text_size;
+
+    memset(resp, 0, sizeof(response_t));
+
+    resp->text = text;
+    resp->text_size = text_size;
+    if(resp->text) {
+        resp->text[0] = '\0';
+    }
+}
+
+void response_feed(response_t *resp, const char *data, size_t len) {
+    size_t i = 0;
+
+    if(resp->head_len < RESPONSE_HEAD_MAX) {
+        i = MIN(len, RESPONSE_HEAD_MAX - resp->head_len);
+        memcpy(resp->head + resp->head_len, data, i);
+        resp->head_len += i;
+        resp->head[resp->head_len] = '\0';
+    }
+
+    for(i = 0; i < len && !resp->fl_invalid; ) {
+        if(response_step(resp, (uint8_t)data[i])) {
+            i++;
+        }
+    }
+}
+
+/* a whole document has been taken, a number at the very end is only known to be over here */
+switch_bool_t response_complete(response_t *resp) {
+    if(resp->state == RS_LITERAL && resp->depth == 0 && !resp->fl_invalid) {
+        response_literal_end(resp);
+    }
+    return (resp->state == RS_DONE && !resp->fl_invalid);
+}
+
+/* the text buffer goes to the caller (free() it), the next response grows a new one */
+char *response_detach_text(response_t *resp) {
+    char *text = resp->text;
+
+    resp->text = NULL;
+    resp->text_size = 0;
+    resp->text_len = 0;
+
+    return text;
+}
+
+void response_free(response_t *resp) {
+    switch_safe_free(resp->text);
+    resp->text_size = 0;
+    response_reset(resp);
+}
@@ -0,0 +1,205 @@
+#!/usr/bin/env python3
+#
+# realtime_stub.py -- a local stand-in for the realtime transcription service
+#
+# Speaks just enough of the protocol for backend_realtime.c: the session update, appends, commits,
+# transcription deltas and completions. Every utterance is answered with its length, the way the
+# 'mock' backend does, so the module can be tried without the service and without spending the keys:
+#
+#   ./realtime_stub.py --port 8765 --latency-ms 300 --reject 1 --drop-after 2
+#   realtime-url = ws://127.0.0.1:8765/v1/realtime?intent=transcription
+#
+# --reject N      refuse the first N handshakes with 429 (the keys rotation and the backoff)
+# --drop-after N  close the first connection on its N-th commit, before answering it
+#                 (the reconnect and the replay of the audio that has no transcript yet)
+#
+# Only the python standard library is needed.
+#
+
+import argparse
+import base64
+import hashlib
+import json
+import socket
+import struct
+import threading
+import time
+
+WS_GUID = "258EAFA5-E914-47DA-95CA-C5AB0DC85B11"
+BYTES_PER_MS = { "pcm16": 48, "g711_ulaw": 8, "g711_alaw": 8 }
+
+lock = threading.Lock()
+state = { "connections": 0, "rejected": 0, "dropped": 0, "items": 0 }
+
+
+def log(conn_id, text):
+    print("%s [%d] %s" % (time.strftime("%H:%M:%S"), conn_id, text), flush=True)
+
+
+def recv_exact(sock, n):
+    data = b""
+    while len(data) < n:
+        chunk = sock.recv(n - len(data))
+        if not chunk:
+            raise ConnectionError("closed")
+        data += chunk
+    return data
+
+
+def recv_frame(sock):
+    b0, b1 = recv_exact(sock, 2)
+    opcode, length = (b0 & 0x0f), (b1 & 0x7f)
+    if length == 126:
+        length = struct.unpack("!H", recv_exact(sock, 2))[0]
+    elif length == 127:
+        length = struct.unpack("!Q", recv_exact(sock, 8))[0]
+    mask = recv_exact(sock, 4) if (b1 & 0x80) else None
+    payload = recv_exact(sock, length)
+    if mask:
+        payload = bytes(b ^ mask[i % 4] for i, b in enumerate(payload))
+    return (b0 & 0x80) != 0, opcode, payload
+
+
+def send_frame(sock, opcode, payload):
+    head = bytes([0x80 | opcode])
+    if len(payload) < 126:
+        head += bytes([len(payload)])
+    elif len(payload) < 65536:
+        head += bytes([126]) + struct.pack("!H", len(payload))
+    else:
+        head += bytes([127]) + struct.pack("!Q", len(payload))
+    sock.sendall(head + payload)
+
+
+def handshake(sock, conn_id, args):
+    request = b""
+    while b"\r\n\r\n" not in request:
+        chunk = sock.recv(4096)
+        if not chunk:
+            return False
+        request += chunk
+    headers = {}
+    for line in request.decode("latin-1").split("\r\n")[1:]:
+        if ":" in line:
+            name, value = line.split(":", 1)
+            headers[name.strip().lower()] = value.strip()
+
+    with lock:
+        reject = (state["rejected"] < args.reject)
+        if reject:
+            state["rejected"] += 1
+    if reject:
+        log(conn_id, "handshake refused with 429 (key ...%s)" % headers.get("authorization", "")[-4:])
+        sock.sendall(b"HTTP/1.1 429 Too Many Requests\r\nretry-after: 1\r\nx-ratelimit-remaining-requests: 0\r\n"
+                     b"x-ratelimit-reset-requests: 1s\r\ncontent-length: 0\r\nconnection: close\r\n\r\n")
+        return False
+
+    accept = base64.b64encode(hashlib.sha1((headers.get("sec-websocket-key", "") + WS_GUID).encode()).digest()).decode()
+    sock.sendall(("HTTP/1.1 101 Switching Protocols\r\nupgrade: websocket\r\nconnection: Upgrade\r\n"
+                  "sec-websocket-accept: %s\r\n\r\n" % accept).encode())
+    log(conn_id, "connected (key ...%s)" % headers.get("authorization", "")[-4:])
+    return True
+
+
+def transcribe(sock, send_lock, conn_id, item_id, text, args):
+    time.sleep(args.latency_ms / 1000.0)
+    words = text.split(" ")
+    try:
+        for i, word in enumerate(words):
+            delta = (word if i == 0 else " " + word)
+            with send_lock:
+                send_frame(sock, 1, json.dumps({ "type": "conversation.item.input_audio_transcription.delta", "item_id": item_id, "delta": delta }).encode())
+            time.sleep(args.delta_ms / 1000.0)
+        with send_lock:
+            send_frame(sock, 1, json.dumps({ "type": "conversation.item.input_audio_transcription.completed", "item_id": item_id, "transcript": text }).encode())
+        log(conn_id, "%s: %s" % (item_id, text))
+    except OSError:
+        pass
+
+
+def serve(sock, conn_id, args):
+    send_lock = threading.Lock()
+    audio_format, audio_len, commits, message = "pcm16", 0, 0, b""
+
+    if not handshake(sock, conn_id, args):
+        return
+
+    while True:
+        fin, opcode, payload = recv_frame(sock)
+        if opcode == 8:
+            with send_lock:
+                send_frame(sock, 8, payload[:2])
+            log(conn_id, "closed by the client")
+            return
+        if opcode == 9:
+            with send_lock:
+                send_frame(sock, 10, payload)
+            continue
+        if opcode not in (0, 1):
+            continue
+        message += payload
+        if not fin:
+            continue
+        msg, message = json.loads(message), b""
+
+        if msg["type"] == "transcription_session.update":
+            audio_format = msg["session"].get("input_audio_format", audio_format)
+            with send_lock:
+                send_frame(sock, 1, json.dumps({ "type": "transcription_session.updated", "session": msg["session"] }).encode())
+            log(conn_id, "session: %s" % json.dumps(msg["session"]))
+        elif msg["type"] == "input_audio_buffer.append":
+            audio_len += len(base64.b64decode(msg["audio"]))
+        elif msg["type"] == "input_audio_buffer.commit":
+            commits += 1
+            with lock:
+                drop = (args.drop_after and commits >= args.drop_after and not state["dropped"])
+                if drop:
+                    state["dropped"] += 1
+            if drop:
+                log(conn_id, "dropping the connection on commit %d (%d bytes unanswered)" % (commits, audio_len))
+                return
+            with lock:
+                state["items"] += 1
+                item_id = "item_%d" % state["items"]
+            with send_lock:
+                send_frame(sock, 1, json.dumps({ "type": "input_audio_buffer.committed", "item_id": item_id }).encode())
+            text = "utterance of %d ms" % (audio_len // BYTES_PER_MS.get(audio_format, 48))
+            audio_len = 0
+            threading.Thread(target=transcribe, args=(sock, send_lock, conn_id, item_id, text, args), daemon=True).start()
+
+
+def client(sock, args):
+    with lock:
+        state["connections"] += 1
+        conn_id = state["connections"]
+    try:
+        serve(sock, conn_id, args)
+    except (ConnectionError, OSError, ValueError, KeyError) as e:
+        log(conn_id, "connection lost (%s)" % e)
+    finally:
+        sock.close()
+
+
+def main():
+    parser = argparse.ArgumentParser(description="a local stand-in for the realtime transcription service")
+    parser.add_argument("--host", default="127.0.0.1")
+    parser.add_argument("--port", type=int, default=8765)
+    parser.add_argument("--latency-ms", type=int, default=300, help="from the commit to the first delta")
+    parser.add_argument("--delta-ms", type=int, default=50, help="between the deltas")
+    parser.add_argument("--reject", type=int, default=0, help="refuse the first N handshakes with 429")
+    parser.add_argument("--drop-after", type=int, default=0, help="close the first connection on its N-th commit")
+    args = parser.parse_args()
+
+    server = socket.socket(socket.AF_INET, socket.SOCK_STREAM)
+    server.setsockopt(socket.SOL_SOCKET, socket.SO_REUSEADDR, 1)
+    server.bind((args.host, args.port))
+    server.listen(16)
+    print("listening on ws://%s:%d" % (args.host, args.port), flush=True)
+
+    while True:
+        sock, _ = server.accept()
+        threading.Thread(target=client, args=(sock, args), daemon=True).start()
+
+
+if __name__ == "__main__":
+    main()